@@ -19,6 +19,9 @@
 #include <linux/highmem.h>
 #include <linux/sched/sysctl.h>
 #include <linux/blk-crypto.h>
+#include <linux/cpuhotplug.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <trace/events/block.h>
 #include "blk.h"
@@ -30,6 +33,24 @@
  */
 #define BIO_INLINE_VECS		4
 
+/*
+ * Per-cpu cache of freed bios for biosets created with BIOSET_PERCPU_CACHE.
+ * Only bios with inline vecs are recycled, so a cached bio can be handed out
+ * again without touching the bvec pool. The lock is taken with interrupts
+ * disabled, as bios may be freed from completion context. It is only ever
+ * contended by the shrinker, which trims the caches of all cpus under
+ * memory pressure.
+ */
+#define ALLOC_CACHE_MAX		256
+
+struct bio_alloc_cache {
+	spinlock_t		lock;
+	struct bio		*free_list;
+	unsigned int		nr;
+	unsigned long		hits;
+	unsigned long		misses;
+};
+
 /*
  * if you change this list, also change bvec_alloc or things will
  * break badly! cannot be bigger than what you can fit into an
@@ -247,6 +268,149 @@ void bio_uninit(struct bio *bio)
 }
 EXPORT_SYMBOL(bio_uninit);
 
+/*
+ * Pop a bio from the local cpu's cache. Returns the start of the allocation
+ * (i.e. including front padding) like mempool_alloc() would, or NULL.
+ */
+static void *bio_alloc_cache_get(struct bio_set *bs)
+{
+	struct bio_alloc_cache *cache;
+	struct bio *bio = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	spin_lock(&cache->lock);
+	if (cache->free_list) {
+		bio = cache->free_list;
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	spin_unlock(&cache->lock);
+	local_irq_restore(flags);
+
+	if (!bio)
+		return NULL;
+	return (void *)bio - bs->front_pad;
+}
+
+static bool bio_alloc_cache_put(struct bio_set *bs, struct bio *bio)
+{
+	struct bio_alloc_cache *cache;
+	unsigned long flags;
+	bool cached = false;
+
+	/*
+	 * Refill the mempool reserve first. Otherwise it could end up parked
+	 * in the caches of other cpus, with mempool_alloc() waiting forever
+	 * for an element to come back.
+	 */
+	if (READ_ONCE(bs->bio_pool.curr_nr) < bs->bio_pool.min_nr)
+		return false;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	spin_lock(&cache->lock);
+	if (cache->nr < ALLOC_CACHE_MAX) {
+		bio->bi_next = cache->free_list;
+		cache->free_list = bio;
+		cache->nr++;
+		cached = true;
+	}
+	spin_unlock(&cache->lock);
+	local_irq_restore(flags);
+
+	return cached;
+}
+
+/*
+ * Return up to @nr bios of @cache to the mempool, which refills its reserve
+ * and hands the rest back to the slab.
+ */
+static unsigned long bio_alloc_cache_prune(struct bio_set *bs,
+					   struct bio_alloc_cache *cache,
+					   unsigned long nr)
+{
+	struct bio *bio, *list = NULL;
+	unsigned long flags, freed = 0;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	while (freed < nr && (bio = cache->free_list) != NULL) {
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+		bio->bi_next = list;
+		list = bio;
+		freed++;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = list) != NULL) {
+		list = bio->bi_next;
+		mempool_free((void *)bio - bs->front_pad, &bs->bio_pool);
+	}
+	return freed;
+}
+
+static unsigned long bio_alloc_cache_count(struct shrinker *shrink,
+					   struct shrink_control *sc)
+{
+	struct bio_set *bs = container_of(shrink, struct bio_set,
+					  cache_shrinker);
+	unsigned long nr = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		nr += READ_ONCE(per_cpu_ptr(bs->cache, cpu)->nr);
+	return nr ? nr : SHRINK_EMPTY;
+}
+
+static unsigned long bio_alloc_cache_scan(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	struct bio_set *bs = container_of(shrink, struct bio_set,
+					  cache_shrinker);
+	unsigned long freed = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		freed += bio_alloc_cache_prune(bs, per_cpu_ptr(bs->cache, cpu),
+					       sc->nr_to_scan - freed);
+		if (freed >= sc->nr_to_scan)
+			break;
+	}
+	return freed;
+}
+
+static int bio_cpu_dead(unsigned int cpu, struct hlist_node *node)
+{
+	struct bio_set *bs;
+
+	bs = hlist_entry_safe(node, struct bio_set, cpuhp_dead);
+	if (bs->cache)
+		bio_alloc_cache_prune(bs, per_cpu_ptr(bs->cache, cpu),
+				      ULONG_MAX);
+	return 0;
+}
+
+static void bio_alloc_cache_destroy(struct bio_set *bs)
+{
+	int cpu;
+
+	if (!bs->cache)
+		return;
+
+	cpuhp_state_remove_instance_nocalls(CPUHP_BIO_DEAD, &bs->cpuhp_dead);
+	unregister_shrinker(&bs->cache_shrinker);
+	for_each_possible_cpu(cpu)
+		bio_alloc_cache_prune(bs, per_cpu_ptr(bs->cache, cpu),
+				      ULONG_MAX);
+	free_percpu(bs->cache);
+	bs->cache = NULL;
+}
+
 static void bio_free(struct bio *bio)
 {
 	struct bio_set *bs = bio->bi_pool;
@@ -255,6 +419,10 @@ static void bio_free(struct bio *bio)
 	bio_uninit(bio);
 
 	if (bs) {
+		if (bio_flagged(bio, BIO_PERCPU_CACHE) &&
+		    bio_alloc_cache_put(bs, bio))
+			return;
+
 		bvec_free(&bs->bvec_pool, bio->bi_io_vec, BVEC_POOL_IDX(bio));
 
 		/*
@@ -441,8 +609,9 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, unsigned int nr_iovecs,
 	unsigned front_pad;
 	unsigned inline_vecs;
 	struct bio_vec *bvl = NULL;
+	bool use_cache = false;
 	struct bio *bio;
-	void *p;
+	void *p = NULL;
 
 	if (!bs) {
 		if (nr_iovecs > UIO_MAXIOV)
@@ -483,11 +652,18 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, unsigned int nr_iovecs,
 		    bs->rescue_workqueue)
 			gfp_mask &= ~__GFP_DIRECT_RECLAIM;
 
-		p = mempool_alloc(&bs->bio_pool, gfp_mask);
-		if (!p && gfp_mask != saved_gfp) {
-			punt_bios_to_rescuer(bs);
-			gfp_mask = saved_gfp;
+		if (bs->cache && nr_iovecs <= BIO_INLINE_VECS) {
+			use_cache = true;
+			p = bio_alloc_cache_get(bs);
+		}
+
+		if (!p) {
 			p = mempool_alloc(&bs->bio_pool, gfp_mask);
+			if (!p && gfp_mask != saved_gfp) {
+				punt_bios_to_rescuer(bs);
+				gfp_mask = saved_gfp;
+				p = mempool_alloc(&bs->bio_pool, gfp_mask);
+			}
 		}
 
 		front_pad = bs->front_pad;
@@ -499,6 +675,8 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, unsigned int nr_iovecs,
 
 	bio = p + front_pad;
 	bio_init(bio, NULL, 0);
+	if (use_cache)
+		bio_set_flag(bio, BIO_PERCPU_CACHE);
 
 	if (nr_iovecs > inline_vecs) {
 		unsigned long idx = 0;
@@ -1547,6 +1725,8 @@ int biovec_init_pool(mempool_t *pool, int pool_entries)
  */
 void bioset_exit(struct bio_set *bs)
 {
+	bio_alloc_cache_destroy(bs);
+
 	if (bs->rescue_workqueue)
 		destroy_workqueue(bs->rescue_workqueue);
 	bs->rescue_workqueue = NULL;
@@ -1566,8 +1746,8 @@ EXPORT_SYMBOL(bioset_exit);
  * @bs:		pool to initialize
  * @pool_size:	Number of bio and bio_vecs to cache in the mempool
  * @front_pad:	Number of bytes to allocate in front of the returned bio
- * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS
- *              and %BIOSET_NEED_RESCUER
+ * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS,
+ *              %BIOSET_NEED_RESCUER and %BIOSET_PERCPU_CACHE
  *
  * Description:
  *    Set up a bio_set to be used with @bio_alloc_bioset. Allows the caller
@@ -1580,6 +1760,10 @@ EXPORT_SYMBOL(bioset_exit);
  *    for allocating iovecs.  This pool is not needed e.g. for bio_clone_fast().
  *    If %BIOSET_NEED_RESCUER is set, a workqueue is created which can be used to
  *    dispatch queued requests when the mempool runs out of space.
+ *    If %BIOSET_PERCPU_CACHE is set, freed bios with inline vecs are kept
+ *    in a per-cpu cache and handed out again without going through the
+ *    mempool and slab allocator. The cache is only filled while the mempool
+ *    reserve is full, and is trimmed by a shrinker under memory pressure.
  *
  */
 int bioset_init(struct bio_set *bs,
@@ -1606,12 +1790,33 @@ int bioset_init(struct bio_set *bs,
 	    biovec_init_pool(&bs->bvec_pool, pool_size))
 		goto bad;
 
-	if (!(flags & BIOSET_NEED_RESCUER))
-		return 0;
+	if (flags & BIOSET_NEED_RESCUER) {
+		bs->rescue_workqueue = alloc_workqueue("bioset",
+						       WQ_MEM_RECLAIM, 0);
+		if (!bs->rescue_workqueue)
+			goto bad;
+	}
 
-	bs->rescue_workqueue = alloc_workqueue("bioset", WQ_MEM_RECLAIM, 0);
-	if (!bs->rescue_workqueue)
-		goto bad;
+	if (flags & BIOSET_PERCPU_CACHE) {
+		int cpu;
+
+		bs->cache = alloc_percpu(struct bio_alloc_cache);
+		if (!bs->cache)
+			goto bad;
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(bs->cache, cpu)->lock);
+
+		bs->cache_shrinker.count_objects = bio_alloc_cache_count;
+		bs->cache_shrinker.scan_objects = bio_alloc_cache_scan;
+		bs->cache_shrinker.seeks = DEFAULT_SEEKS;
+		if (register_shrinker(&bs->cache_shrinker)) {
+			free_percpu(bs->cache);
+			bs->cache = NULL;
+			goto bad;
+		}
+		cpuhp_state_add_instance_nocalls(CPUHP_BIO_DEAD,
+						 &bs->cpuhp_dead);
+	}
 
 	return 0;
 bad:
@@ -1633,6 +1838,8 @@ int bioset_init_from_src(struct bio_set *bs, struct bio_set *src)
 		flags |= BIOSET_NEED_BVECS;
 	if (src->rescue_workqueue)
 		flags |= BIOSET_NEED_RESCUER;
+	if (src->cache)
+		flags |= BIOSET_PERCPU_CACHE;
 
 	return bioset_init(bs, src->bio_pool.min_nr, src->front_pad, flags);
 }
@@ -1672,7 +1879,11 @@ static int __init init_bio(void)
 	bio_integrity_init();
 	biovec_init_slabs();
 
-	if (bioset_init(&fs_bio_set, BIO_POOL_SIZE, 0, BIOSET_NEED_BVECS))
+	cpuhp_setup_state_multi(CPUHP_BIO_DEAD, "block/bio:dead", NULL,
+				bio_cpu_dead);
+
+	if (bioset_init(&fs_bio_set, BIO_POOL_SIZE, 0,
+			BIOSET_NEED_BVECS | BIOSET_PERCPU_CACHE))
 		panic("bio: can't allocate bios\n");
 
 	if (bioset_integrity_create(&fs_bio_set, BIO_POOL_SIZE))
@@ -1681,3 +1892,34 @@ static int __init init_bio(void)
 	return 0;
 }
 subsys_initcall(init_bio);
+
+#ifdef CONFIG_DEBUG_FS
+static int fs_bio_cache_show(struct seq_file *m, void *v)
+{
+	unsigned long hits = 0, misses = 0, cached = 0;
+	int cpu;
+
+	if (!fs_bio_set.cache)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct bio_alloc_cache *cache = per_cpu_ptr(fs_bio_set.cache, cpu);
+
+		hits += READ_ONCE(cache->hits);
+		misses += READ_ONCE(cache->misses);
+		cached += READ_ONCE(cache->nr);
+	}
+	seq_printf(m, "hits %lu\nmisses %lu\ncached %lu\n",
+		   hits, misses, cached);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fs_bio_cache);
+
+static int __init bio_debugfs_init(void)
+{
+	debugfs_create_file("fs_bio_cache", 0400, blk_debugfs_root, NULL,
+			    &fs_bio_cache_fops);
+	return 0;
+}
+late_initcall(bio_debugfs_init);
+#endif
@@ -374,6 +374,8 @@ void blk_cleanup_queue(struct request_queue *q)
 
 	WARN_ON_ONCE(blk_queue_registered(q));
 
+	blk_discard_queue_exit(q);
+
 	/* mark @q DYING, no new request or merges will be allowed afterwards */
 	blk_set_queue_dying(q);
 
@@ -893,6 +895,11 @@ static noinline_for_stack bool submit_bio_checks(struct bio *bio)
 	if (unlikely(!current->io_context))
 		create_task_io_context(current, GFP_ATOMIC, q->node);
 
+	if (!blk_discard_queue_check_bio(q, bio)) {
+		status = BLK_STS_AGAIN;
+		goto end_io;
+	}
+
 	if (blk_throtl_bio(bio))
 		return false;
 
@@ -1688,6 +1695,20 @@ EXPORT_SYMBOL(kblockd_mod_delayed_work_on);
  *   this kind of deadlock.
  */
 void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_start_plug_nr_ios - start a plug for a known number of I/Os
+ * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of I/Os the caller expects to submit under the plug
+ *
+ * Like blk_start_plug(), but lets blk-mq allocate the requests for up to
+ * @nr_ios I/Os with a single tag allocation.
+ */
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned short nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -1699,6 +1720,8 @@ void blk_start_plug(struct blk_plug *plug)
 
 	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
+	INIT_LIST_HEAD(&plug->cached_rqs);
+	plug->nr_ios = min_t(unsigned short, nr_ios, BLK_MAX_REQUEST_COUNT);
 	plug->rq_count = 0;
 	plug->multiple_queues = false;
 	plug->nowait = false;
@@ -1709,7 +1732,7 @@ void blk_start_plug(struct blk_plug *plug)
 	 */
 	tsk->plug = plug;
 }
-EXPORT_SYMBOL(blk_start_plug);
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
 
 static void flush_plug_callbacks(struct blk_plug *plug, bool from_schedule)
 {
@@ -1759,6 +1782,9 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 
 	if (!list_empty(&plug->mq_list))
 		blk_mq_flush_plug_list(plug, from_schedule);
+	/* don't sleep holding tags that others may be waiting for */
+	if (from_schedule && !list_empty(&plug->cached_rqs))
+		blk_mq_free_plug_rqs(plug);
 }
 
 /**
@@ -1776,6 +1802,8 @@ void blk_finish_plug(struct blk_plug *plug)
 	if (plug != current->plug)
 		return;
 	blk_flush_plug_list(plug, false);
+	if (!list_empty(&plug->cached_rqs))
+		blk_mq_free_plug_rqs(plug);
 
 	current->plug = NULL;
 }
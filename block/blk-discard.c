@@ -0,0 +1,520 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Asynchronous background discard queue.
+ *
+ * Callers passing BLKDEV_DISCARD_ASYNC to blkdev_issue_discard() hand their
+ * ranges to a per-queue list instead of waiting for the device. Adjacent and
+ * overlapping ranges are coalesced, and the result is trickled out from a
+ * work item once the device has seen no other I/O for discard_async_idle_ms,
+ * or once ranges have been pending for DQ_MAX_DELAY.
+ *
+ * Queued discards must never be reordered against later writes to the same
+ * blocks. Writes trim the overlapping part out of any pending range, and wait
+ * for overlapping discards that have already been sent to the device.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "blk.h"
+
+/* Issue pending ranges at the latest this long after they were queued */
+#define DQ_MAX_DELAY		(5 * HZ)
+/* Ranges issued per work run before re-checking for foreground I/O */
+#define DQ_BATCH		16
+/* Above this many pending ranges, fall back to synchronous discard */
+#define DQ_MAX_RANGES		4096
+
+struct blk_discard_range {
+	struct rb_node		node;
+	struct list_head	list;	/* on ->inflight once issued */
+	sector_t		start;
+	sector_t		end;
+};
+
+struct blk_discard_queue {
+	struct request_queue	*q;
+	spinlock_t		lock;
+	bool			enabled;
+	unsigned int		idle_ms;
+
+	/* whole-disk bdev the pending ranges belong to */
+	struct block_device	*bdev;
+
+	struct rb_root		ranges;
+	unsigned int		nr_ranges;
+	unsigned long		first_queued;
+
+	struct list_head	inflight;
+	unsigned int		nr_inflight;
+	wait_queue_head_t	wait;
+
+	/*
+	 * Ranges in the tree or in flight. Moving a range from one to the
+	 * other leaves it unchanged, so it can be checked without the lock.
+	 */
+	unsigned int		nr_pending;
+
+	unsigned long		last_io;
+	struct delayed_work	work;
+};
+
+static inline bool dq_overlaps(struct blk_discard_range *r, sector_t start,
+			       sector_t end)
+{
+	return r->start < end && r->end > start;
+}
+
+/*
+ * Last range starting before @end, i.e. the rightmost candidate for
+ * overlapping or touching [.., @end). Caller holds dq->lock.
+ */
+static struct blk_discard_range *dq_find_before(struct blk_discard_queue *dq,
+						sector_t end)
+{
+	struct rb_node *n = dq->ranges.rb_node;
+	struct blk_discard_range *found = NULL;
+
+	while (n) {
+		struct blk_discard_range *r =
+			rb_entry(n, struct blk_discard_range, node);
+
+		if (r->start <= end) {
+			found = r;
+			n = n->rb_right;
+		} else {
+			n = n->rb_left;
+		}
+	}
+	return found;
+}
+
+static struct blk_discard_range *dq_prev(struct blk_discard_range *r)
+{
+	struct rb_node *n = rb_prev(&r->node);
+
+	return n ? rb_entry(n, struct blk_discard_range, node) : NULL;
+}
+
+static void dq_insert(struct blk_discard_queue *dq,
+		      struct blk_discard_range *new)
+{
+	struct rb_node **p = &dq->ranges.rb_node, *parent = NULL;
+
+	while (*p) {
+		struct blk_discard_range *r;
+
+		parent = *p;
+		r = rb_entry(parent, struct blk_discard_range, node);
+		if (new->start < r->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &dq->ranges);
+	dq->nr_ranges++;
+	WRITE_ONCE(dq->nr_pending, dq->nr_pending + 1);
+}
+
+/* Take @r off the tree, the caller either issues or frees it */
+static void __dq_erase(struct blk_discard_queue *dq,
+		       struct blk_discard_range *r)
+{
+	rb_erase(&r->node, &dq->ranges);
+	dq->nr_ranges--;
+}
+
+static void dq_erase(struct blk_discard_queue *dq, struct blk_discard_range *r)
+{
+	__dq_erase(dq, r);
+	WRITE_ONCE(dq->nr_pending, dq->nr_pending - 1);
+	kfree(r);
+}
+
+/*
+ * Don't push an already armed work item out, or a steady stream of new
+ * ranges would keep the queue from ever being looked at.
+ */
+static void dq_schedule(struct blk_discard_queue *dq)
+{
+	if (!delayed_work_pending(&dq->work))
+		kblockd_mod_delayed_work_on(WORK_CPU_UNBOUND, &dq->work,
+					    msecs_to_jiffies(dq->idle_ms));
+}
+
+/*
+ * Queue [@sector, @sector + @nr_sects) of @bdev for background discard.
+ * Returns false if the caller should issue the discard itself.
+ */
+bool blk_discard_queue_add(struct block_device *bdev, sector_t sector,
+			   sector_t nr_sects)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+	struct blk_discard_queue *dq = q->discard_queue;
+	struct block_device *whole = bdev->bd_contains;
+	struct blk_discard_range *new, *r, *prev;
+	sector_t start, end;
+	unsigned long flags;
+	bool queued = false;
+
+	if (!dq || !READ_ONCE(dq->enabled) || !nr_sects)
+		return false;
+
+	start = sector + get_start_sect(bdev);
+	end = start + nr_sects;
+
+	new = kmalloc(sizeof(*new), GFP_NOIO);
+	if (!new)
+		return false;
+	new->start = start;
+	new->end = end;
+
+	spin_lock_irqsave(&dq->lock, flags);
+	if (!dq->enabled || blk_queue_dying(q) ||
+	    dq->nr_ranges >= DQ_MAX_RANGES ||
+	    (dq->bdev && dq->bdev != whole))
+		goto out_unlock;
+
+	if (!dq->bdev) {
+		dq->bdev = bdgrab(whole);
+		if (!dq->bdev)
+			goto out_unlock;
+	}
+
+	/* Swallow every pending range overlapping or touching the new one */
+	r = dq_find_before(dq, end);
+	while (r && r->end >= start) {
+		prev = dq_prev(r);
+		new->start = min(new->start, r->start);
+		new->end = max(new->end, r->end);
+		dq_erase(dq, r);
+		r = prev;
+	}
+
+	if (RB_EMPTY_ROOT(&dq->ranges))
+		dq->first_queued = jiffies;
+	dq_insert(dq, new);
+	queued = true;
+	dq_schedule(dq);
+out_unlock:
+	spin_unlock_irqrestore(&dq->lock, flags);
+	if (!queued)
+		kfree(new);
+	return queued;
+}
+
+static bool dq_inflight_overlaps(struct blk_discard_queue *dq, sector_t start,
+				 sector_t end)
+{
+	struct blk_discard_range *r;
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&dq->lock, flags);
+	list_for_each_entry(r, &dq->inflight, list) {
+		if (dq_overlaps(r, start, end)) {
+			ret = true;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&dq->lock, flags);
+	return ret;
+}
+
+/*
+ * Called for every bio on a queue with a discard queue attached. Records
+ * foreground activity, and keeps queued discards from landing on top of
+ * newer writes. Returns false if @bio would have to wait but is REQ_NOWAIT.
+ */
+bool __blk_discard_queue_check_bio(struct blk_discard_queue *dq,
+				   struct bio *bio)
+{
+	struct blk_discard_range *r, *prev, *tail = NULL;
+	sector_t start, end;
+	unsigned long flags;
+	bool tried_alloc = false;
+	bool wait;
+
+	if (bio_op(bio) == REQ_OP_DISCARD)
+		return true;
+
+	if (READ_ONCE(dq->enabled))
+		WRITE_ONCE(dq->last_io, jiffies);
+
+	if (!op_is_write(bio_op(bio)) || !bio_sectors(bio))
+		return true;
+	/*
+	 * A range stays counted while it moves from the tree to ->inflight,
+	 * so zero here really means nothing is outstanding.
+	 */
+	if (!READ_ONCE(dq->nr_pending))
+		return true;
+
+	start = bio->bi_iter.bi_sector;
+	end = bio_end_sector(bio);
+
+again:
+	spin_lock_irqsave(&dq->lock, flags);
+	r = dq_find_before(dq, end);
+	while (r && r->end > start) {
+		prev = dq_prev(r);
+		if (r->start < start && r->end > end) {
+			/* Splitting needs a new range, allocate it unlocked */
+			if (!tail && !tried_alloc) {
+				spin_unlock_irqrestore(&dq->lock, flags);
+				tail = kmalloc(sizeof(*tail), GFP_NOWAIT);
+				tried_alloc = true;
+				goto again;
+			}
+			if (tail) {
+				tail->start = end;
+				tail->end = r->end;
+				r->end = start;
+				dq_insert(dq, tail);
+				tail = NULL;
+			} else {
+				/* Dropping a discard is always safe */
+				dq_erase(dq, r);
+			}
+		} else if (r->start < start) {
+			r->end = start;
+		} else if (r->end > end) {
+			/* start moves right, tree order is unchanged */
+			r->start = end;
+		} else {
+			dq_erase(dq, r);
+		}
+		r = prev;
+	}
+	spin_unlock_irqrestore(&dq->lock, flags);
+	kfree(tail);
+
+	wait = READ_ONCE(dq->nr_inflight) &&
+		dq_inflight_overlaps(dq, start, end);
+	if (!wait)
+		return true;
+	if (bio->bi_opf & REQ_NOWAIT)
+		return false;
+
+	wait_event(dq->wait, !dq_inflight_overlaps(dq, start, end));
+	return true;
+}
+
+static void dq_range_done(struct blk_discard_queue *dq,
+			  struct blk_discard_range *r)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dq->lock, flags);
+	list_del(&r->list);
+	dq->nr_inflight--;
+	WRITE_ONCE(dq->nr_pending, dq->nr_pending - 1);
+	spin_unlock_irqrestore(&dq->lock, flags);
+
+	wake_up_all(&dq->wait);
+	kfree(r);
+}
+
+static void dq_end_io(struct bio *bio)
+{
+	struct blk_discard_range *r = bio->bi_private;
+
+	dq_range_done(bio->bi_disk->queue->discard_queue, r);
+	bio_put(bio);
+}
+
+/*
+ * Send up to DQ_BATCH pending ranges to the device. Unless @force is set,
+ * this only happens once the device has been idle for idle_ms or the oldest
+ * range has waited DQ_MAX_DELAY. Returns true if ranges are left pending.
+ */
+static bool dq_issue(struct blk_discard_queue *dq, bool force)
+{
+	struct blk_discard_range *batch[DQ_BATCH];
+	unsigned long idle = msecs_to_jiffies(dq->idle_ms);
+	struct blk_plug plug;
+	struct rb_node *n;
+	int i, nr = 0;
+	bool more;
+
+	spin_lock_irq(&dq->lock);
+	if (!force && !RB_EMPTY_ROOT(&dq->ranges) &&
+	    time_before(jiffies, READ_ONCE(dq->last_io) + idle) &&
+	    time_before(jiffies, dq->first_queued + DQ_MAX_DELAY)) {
+		spin_unlock_irq(&dq->lock);
+		return true;
+	}
+
+	while (nr < DQ_BATCH && (n = rb_first(&dq->ranges))) {
+		struct blk_discard_range *r =
+			rb_entry(n, struct blk_discard_range, node);
+
+		__dq_erase(dq, r);
+		list_add_tail(&r->list, &dq->inflight);
+		dq->nr_inflight++;
+		batch[nr++] = r;
+	}
+	more = !RB_EMPTY_ROOT(&dq->ranges);
+	spin_unlock_irq(&dq->lock);
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		struct blk_discard_range *r = batch[i];
+		struct bio *bio = NULL;
+		int ret;
+
+		ret = __blkdev_issue_discard(dq->bdev, r->start,
+					     r->end - r->start, GFP_NOIO, 0,
+					     &bio);
+		if (ret || !bio) {
+			dq_range_done(dq, r);
+			continue;
+		}
+		bio->bi_private = r;
+		bio->bi_end_io = dq_end_io;
+		submit_bio(bio);
+	}
+	blk_finish_plug(&plug);
+
+	return more;
+}
+
+static void dq_work_fn(struct work_struct *work)
+{
+	struct blk_discard_queue *dq =
+		container_of(to_delayed_work(work), struct blk_discard_queue,
+			     work);
+
+	if (dq_issue(dq, false))
+		dq_schedule(dq);
+}
+
+static void dq_drain(struct blk_discard_queue *dq)
+{
+	while (dq_issue(dq, true))
+		;
+	wait_event(dq->wait, !READ_ONCE(dq->nr_inflight));
+}
+
+/**
+ * blkdev_drain_discards - issue and wait for queued background discards
+ * @bdev:	blockdev whose queue to drain
+ *
+ * Description:
+ *    Used on fsync and unmount so that discards queued with
+ *    %BLKDEV_DISCARD_ASYNC have reached the device when they return.
+ */
+void blkdev_drain_discards(struct block_device *bdev)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+	struct blk_discard_queue *dq = q ? READ_ONCE(q->discard_queue) : NULL;
+
+	if (dq && READ_ONCE(dq->nr_pending))
+		dq_drain(dq);
+}
+EXPORT_SYMBOL(blkdev_drain_discards);
+
+static struct blk_discard_queue *blk_discard_queue_alloc(struct request_queue *q)
+{
+	struct blk_discard_queue *dq;
+
+	dq = kzalloc_node(sizeof(*dq), GFP_KERNEL, q->node);
+	if (!dq)
+		return NULL;
+
+	dq->q = q;
+	spin_lock_init(&dq->lock);
+	dq->idle_ms = 10;
+	dq->ranges = RB_ROOT;
+	INIT_LIST_HEAD(&dq->inflight);
+	init_waitqueue_head(&dq->wait);
+	INIT_DELAYED_WORK(&dq->work, dq_work_fn);
+	return dq;
+}
+
+bool blk_discard_queue_enabled(struct request_queue *q)
+{
+	return q->discard_queue && q->discard_queue->enabled;
+}
+
+/* Called with q->sysfs_lock held */
+int blk_discard_queue_set_enabled(struct request_queue *q, bool enable)
+{
+	struct blk_discard_queue *dq = q->discard_queue;
+
+	if (!enable) {
+		if (dq) {
+			WRITE_ONCE(dq->enabled, false);
+			dq_drain(dq);
+		}
+		return 0;
+	}
+
+	if (!blk_queue_discard(q))
+		return -EINVAL;
+	if (!dq) {
+		dq = blk_discard_queue_alloc(q);
+		if (!dq)
+			return -ENOMEM;
+		smp_store_release(&q->discard_queue, dq);
+	}
+	WRITE_ONCE(dq->enabled, true);
+	return 0;
+}
+
+unsigned int blk_discard_queue_idle_ms(struct request_queue *q)
+{
+	return q->discard_queue ? q->discard_queue->idle_ms : 10;
+}
+
+int blk_discard_queue_set_idle_ms(struct request_queue *q, unsigned int ms)
+{
+	if (!q->discard_queue)
+		return -EINVAL;
+	WRITE_ONCE(q->discard_queue->idle_ms, ms);
+	return 0;
+}
+
+/*
+ * Queue teardown: pending ranges are dropped rather than issued, as discards
+ * are only advisory and the device is going away.
+ */
+void blk_discard_queue_exit(struct request_queue *q)
+{
+	struct blk_discard_queue *dq = q->discard_queue;
+	struct blk_discard_range *r, *next;
+
+	if (!dq)
+		return;
+
+	spin_lock_irq(&dq->lock);
+	dq->enabled = false;
+	spin_unlock_irq(&dq->lock);
+	cancel_delayed_work_sync(&dq->work);
+
+	spin_lock_irq(&dq->lock);
+	rbtree_postorder_for_each_entry_safe(r, next, &dq->ranges, node)
+		kfree(r);
+	dq->ranges = RB_ROOT;
+	WRITE_ONCE(dq->nr_pending, dq->nr_pending - dq->nr_ranges);
+	dq->nr_ranges = 0;
+	spin_unlock_irq(&dq->lock);
+
+	wait_event(dq->wait, !READ_ONCE(dq->nr_inflight));
+
+	if (dq->bdev) {
+		bdput(dq->bdev);
+		dq->bdev = NULL;
+	}
+}
+
+void blk_discard_queue_free(struct request_queue *q)
+{
+	kfree(q->discard_queue);
+	q->discard_queue = NULL;
+}
@@ -450,13 +450,16 @@ void blk_insert_flush(struct request *rq)
  * @gfp_mask:	memory allocation flags (for bio_alloc)
  *
  * Description:
- *    Issue a flush for the block device in question.
+ *    Issue a flush for the block device in question. Any discards still
+ *    sitting in the background discard queue are issued and waited for first.
  */
 int blkdev_issue_flush(struct block_device *bdev, gfp_t gfp_mask)
 {
 	struct bio *bio;
 	int ret = 0;
 
+	blkdev_drain_discards(bdev);
+
 	bio = bio_alloc(gfp_mask, 0);
 	bio_set_dev(bio, bdev);
 	bio->bi_opf = REQ_OP_WRITE | REQ_PREFLUSH;
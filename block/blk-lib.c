@@ -126,7 +126,9 @@ EXPORT_SYMBOL(__blkdev_issue_discard);
  * @flags:	BLKDEV_DISCARD_* flags to control behaviour
  *
  * Description:
- *    Issue a discard request for the sectors in question.
+ *    Issue a discard request for the sectors in question. With
+ *    %BLKDEV_DISCARD_ASYNC, the range may instead be handed to the queue's
+ *    background discard queue, if enabled, and 0 returned right away.
  */
 int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 		sector_t nr_sects, gfp_t gfp_mask, unsigned long flags)
@@ -135,6 +137,13 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 	struct blk_plug plug;
 	int ret;
 
+	if (flags & BLKDEV_DISCARD_ASYNC) {
+		flags &= ~BLKDEV_DISCARD_ASYNC;
+		if (!(flags & BLKDEV_DISCARD_SECURE) &&
+		    blk_discard_queue_add(bdev, sector, nr_sects))
+			return 0;
+	}
+
 	blk_start_plug(&plug);
 	ret = __blkdev_issue_discard(bdev, sector, nr_sects, gfp_mask, flags,
 			&bio);
@@ -13,6 +13,7 @@
 #include "blk-mq-debugfs.h"
 #include "blk-mq-tag.h"
 #include "blk-rq-qos.h"
+#include "blk-stat.h"
 
 static void print_stat(struct seq_file *m, struct blk_rq_stat *stat)
 {
@@ -131,6 +132,7 @@ static const char *const blk_queue_flag_name[] = {
 	QUEUE_FLAG_NAME(RQ_ALLOC_TIME),
 	QUEUE_FLAG_NAME(HCTX_ACTIVE),
 	QUEUE_FLAG_NAME(NOWAIT),
+	QUEUE_FLAG_NAME(LAT_HIST),
 };
 #undef QUEUE_FLAG_NAME
 
@@ -204,8 +206,139 @@ static ssize_t queue_write_hint_store(void *data, const char __user *buf,
 	return count;
 }
 
+static const char *const blk_stat_hist_op_name[BLK_STAT_HIST_OPS] = {
+	[BLK_STAT_HIST_READ]	= "read",
+	[BLK_STAT_HIST_WRITE]	= "write",
+	[BLK_STAT_HIST_DISCARD]	= "discard",
+	[BLK_STAT_HIST_FLUSH]	= "flush",
+};
+
+/* Upper bound of @bucket in microseconds */
+static u64 lat_hist_bucket_usecs(int bucket)
+{
+	return 1ULL << bucket;
+}
+
+/* Bucket holding the @permille'th permille sample out of @total */
+static int lat_hist_percentile(const u64 *nr, u64 total, unsigned int permille)
+{
+	u64 target = div_u64(total * permille + 999, 1000);
+	u64 seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < BLK_STAT_HIST_BUCKETS - 1; bucket++) {
+		seen += nr[bucket];
+		if (seen >= target)
+			break;
+	}
+	return bucket;
+}
+
+static void print_lat_hist_bound(struct seq_file *m, const char *name,
+				 int bucket)
+{
+	if (bucket == BLK_STAT_HIST_BUCKETS - 1)
+		seq_printf(m, " %s>=%lluus", name,
+			   lat_hist_bucket_usecs(bucket - 1));
+	else
+		seq_printf(m, " %s<%lluus", name, lat_hist_bucket_usecs(bucket));
+}
+
+static void print_lat_hist(struct seq_file *m, struct blk_stat_hist *hist)
+{
+	int op, bucket;
+
+	for (op = 0; op < BLK_STAT_HIST_OPS; op++) {
+		const u64 *nr = hist->nr[op];
+		u64 total = 0;
+
+		for (bucket = 0; bucket < BLK_STAT_HIST_BUCKETS; bucket++)
+			total += nr[bucket];
+
+		seq_printf(m, "%s: samples=%llu", blk_stat_hist_op_name[op],
+			   total);
+		if (total) {
+			print_lat_hist_bound(m, "p50",
+					lat_hist_percentile(nr, total, 500));
+			print_lat_hist_bound(m, "p90",
+					lat_hist_percentile(nr, total, 900));
+			print_lat_hist_bound(m, "p99",
+					lat_hist_percentile(nr, total, 990));
+			print_lat_hist_bound(m, "p999",
+					lat_hist_percentile(nr, total, 999));
+		}
+		seq_puts(m, "\n");
+
+		for (bucket = 0; bucket < BLK_STAT_HIST_BUCKETS; bucket++) {
+			if (!nr[bucket])
+				continue;
+			if (bucket == BLK_STAT_HIST_BUCKETS - 1)
+				seq_printf(m, "\t%8llu+ us\t%llu\n",
+					   lat_hist_bucket_usecs(bucket - 1),
+					   nr[bucket]);
+			else
+				seq_printf(m, "\t%8llu  us\t%llu\n",
+					   lat_hist_bucket_usecs(bucket),
+					   nr[bucket]);
+		}
+	}
+}
+
+static int queue_latency_hist_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct blk_stat_hist *hist;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	seq_printf(m, "enabled=%d\n", blk_stat_hist_enabled(q));
+
+	hist = kzalloc(sizeof(*hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_stat_hist_sum(hctx, hist);
+	print_lat_hist(m, hist);
+	kfree(hist);
+	return 0;
+}
+
+static ssize_t queue_latency_hist_write(void *data, const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	struct request_queue *q = data;
+	struct blk_mq_hw_ctx *hctx;
+	char opbuf[16] = { }, *op;
+	unsigned int i;
+	int ret = 0;
+
+	if (blk_queue_dead(q))
+		return -ENOENT;
+
+	if (count >= sizeof(opbuf))
+		goto inval;
+	if (copy_from_user(opbuf, buf, count))
+		return -EFAULT;
+	op = strstrip(opbuf);
+	if (strcmp(op, "enable") == 0) {
+		ret = blk_stat_enable_hist(q);
+	} else if (strcmp(op, "disable") == 0) {
+		blk_stat_disable_hist(q);
+	} else if (strcmp(op, "reset") == 0) {
+		queue_for_each_hw_ctx(q, hctx, i)
+			blk_stat_hist_reset(hctx);
+	} else {
+inval:
+		pr_err("%s: use 'enable', 'disable' or 'reset'\n", __func__);
+		return -EINVAL;
+	}
+	return ret ? ret : count;
+}
+
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_queue_attrs[] = {
 	{ "poll_stat", 0400, queue_poll_stat_show },
+	{ "latency_hist", 0600, queue_latency_hist_show,
+	  queue_latency_hist_write },
 	{ "requeue_list", 0400, .seq_ops = &queue_requeue_list_seq_ops },
 	{ "pm_only", 0600, queue_pm_only_show, NULL },
 	{ "state", 0600, queue_state_show, queue_state_write },
@@ -538,6 +671,8 @@ static int hctx_io_poll_show(void *data, struct seq_file *m)
 	seq_printf(m, "considered=%lu\n", hctx->poll_considered);
 	seq_printf(m, "invoked=%lu\n", hctx->poll_invoked);
 	seq_printf(m, "success=%lu\n", hctx->poll_success);
+	seq_printf(m, "sleeps=%lu\n", hctx->poll_sleeps);
+	seq_printf(m, "sleep_nsec=%lu\n", hctx->poll_sleep_nsec);
 	return 0;
 }
 
@@ -547,6 +682,7 @@ static ssize_t hctx_io_poll_write(void *data, const char __user *buf,
 	struct blk_mq_hw_ctx *hctx = data;
 
 	hctx->poll_considered = hctx->poll_invoked = hctx->poll_success = 0;
+	hctx->poll_sleeps = hctx->poll_sleep_nsec = 0;
 	return count;
 }
 
@@ -612,6 +748,29 @@ static ssize_t hctx_run_write(void *data, const char __user *buf, size_t count,
 	return count;
 }
 
+static int hctx_latency_hist_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	struct blk_stat_hist *hist;
+
+	hist = kzalloc(sizeof(*hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+	blk_stat_hist_sum(hctx, hist);
+	print_lat_hist(m, hist);
+	kfree(hist);
+	return 0;
+}
+
+static ssize_t hctx_latency_hist_write(void *data, const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+
+	blk_stat_hist_reset(hctx);
+	return count;
+}
+
 static int hctx_active_show(void *data, struct seq_file *m)
 {
 	struct blk_mq_hw_ctx *hctx = data;
@@ -795,6 +954,7 @@ static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"dispatched", 0600, hctx_dispatched_show, hctx_dispatched_write},
 	{"queued", 0600, hctx_queued_show, hctx_queued_write},
 	{"run", 0600, hctx_run_show, hctx_run_write},
+	{"latency_hist", 0600, hctx_latency_hist_show, hctx_latency_hist_write},
 	{"active", 0400, hctx_active_show},
 	{"dispatch_busy", 0400, hctx_dispatch_busy_show},
 	{"type", 0400, hctx_type_show},
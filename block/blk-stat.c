@@ -16,8 +16,16 @@ struct blk_queue_stats {
 	struct list_head callbacks;
 	spinlock_t lock;
 	bool enable_accounting;
+	bool enable_hist;
 };
 
+/* Caller holds q->stats->lock */
+static bool blk_stat_needed(struct request_queue *q)
+{
+	return !list_empty(&q->stats->callbacks) ||
+		q->stats->enable_accounting || q->stats->enable_hist;
+}
+
 void blk_rq_stat_init(struct blk_rq_stat *stat)
 {
 	stat->min = -1ULL;
@@ -48,6 +56,39 @@ void blk_rq_stat_add(struct blk_rq_stat *stat, u64 value)
 	stat->nr_samples++;
 }
 
+static int blk_stat_hist_op(const struct request *rq)
+{
+	switch (req_op(rq)) {
+	case REQ_OP_READ:
+		return BLK_STAT_HIST_READ;
+	case REQ_OP_WRITE:
+	case REQ_OP_WRITE_ZEROES:
+	case REQ_OP_WRITE_SAME:
+		return BLK_STAT_HIST_WRITE;
+	case REQ_OP_DISCARD:
+	case REQ_OP_SECURE_ERASE:
+		return BLK_STAT_HIST_DISCARD;
+	case REQ_OP_FLUSH:
+		return BLK_STAT_HIST_FLUSH;
+	default:
+		return -1;
+	}
+}
+
+static void blk_stat_hist_add(struct request *rq, u64 value)
+{
+	struct blk_stat_hist __percpu *hist = READ_ONCE(rq->mq_hctx->lat_hist);
+	u64 usecs = div_u64(value, NSEC_PER_USEC);
+	int op = blk_stat_hist_op(rq);
+	unsigned int bucket;
+
+	if (!hist || op < 0)
+		return;
+
+	bucket = min_t(unsigned int, fls64(usecs), BLK_STAT_HIST_BUCKETS - 1);
+	this_cpu_inc(hist->nr[op][bucket]);
+}
+
 void blk_stat_add(struct request *rq, u64 now)
 {
 	struct request_queue *q = rq->q;
@@ -60,6 +101,9 @@ void blk_stat_add(struct request *rq, u64 now)
 
 	blk_throtl_stat_add(rq, value);
 
+	if (blk_stat_hist_enabled(q) && rq->mq_hctx)
+		blk_stat_hist_add(rq, value);
+
 	rcu_read_lock();
 	cpu = get_cpu();
 	list_for_each_entry_rcu(cb, &q->stats->callbacks, list) {
@@ -161,7 +205,7 @@ void blk_stat_remove_callback(struct request_queue *q,
 
 	spin_lock_irqsave(&q->stats->lock, flags);
 	list_del_rcu(&cb->list);
-	if (list_empty(&q->stats->callbacks) && !q->stats->enable_accounting)
+	if (!blk_stat_needed(q))
 		blk_queue_flag_clear(QUEUE_FLAG_STATS, q);
 	spin_unlock_irqrestore(&q->stats->lock, flags);
 
@@ -195,6 +239,75 @@ void blk_stat_enable_accounting(struct request_queue *q)
 }
 EXPORT_SYMBOL_GPL(blk_stat_enable_accounting);
 
+int blk_stat_enable_hist(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned long flags;
+	unsigned int i;
+
+	if (!queue_is_mq(q))
+		return -EINVAL;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		struct blk_stat_hist __percpu *hist;
+
+		if (hctx->lat_hist)
+			continue;
+		hist = alloc_percpu(struct blk_stat_hist);
+		if (!hist)
+			return -ENOMEM;
+		if (cmpxchg(&hctx->lat_hist, NULL, hist))
+			free_percpu(hist);
+	}
+
+	spin_lock_irqsave(&q->stats->lock, flags);
+	q->stats->enable_hist = true;
+	blk_queue_flag_set(QUEUE_FLAG_STATS, q);
+	blk_queue_flag_set(QUEUE_FLAG_LAT_HIST, q);
+	spin_unlock_irqrestore(&q->stats->lock, flags);
+	return 0;
+}
+
+void blk_stat_disable_hist(struct request_queue *q)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->stats->lock, flags);
+	q->stats->enable_hist = false;
+	blk_queue_flag_clear(QUEUE_FLAG_LAT_HIST, q);
+	if (!blk_stat_needed(q))
+		blk_queue_flag_clear(QUEUE_FLAG_STATS, q);
+	spin_unlock_irqrestore(&q->stats->lock, flags);
+}
+
+void blk_stat_hist_sum(struct blk_mq_hw_ctx *hctx, struct blk_stat_hist *dst)
+{
+	int cpu, op, bucket;
+
+	if (!hctx->lat_hist)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_stat_hist *hist = per_cpu_ptr(hctx->lat_hist, cpu);
+
+		for (op = 0; op < BLK_STAT_HIST_OPS; op++)
+			for (bucket = 0; bucket < BLK_STAT_HIST_BUCKETS; bucket++)
+				dst->nr[op][bucket] += READ_ONCE(hist->nr[op][bucket]);
+	}
+}
+
+void blk_stat_hist_reset(struct blk_mq_hw_ctx *hctx)
+{
+	int cpu;
+
+	if (!hctx->lat_hist)
+		return;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(hctx->lat_hist, cpu), 0,
+		       sizeof(struct blk_stat_hist));
+}
+
 struct blk_queue_stats *blk_alloc_queue_stats(void)
 {
 	struct blk_queue_stats *stats;
@@ -206,6 +319,7 @@ struct blk_queue_stats *blk_alloc_queue_stats(void)
 	INIT_LIST_HEAD(&stats->callbacks);
 	spin_lock_init(&stats->lock);
 	stats->enable_accounting = false;
+	stats->enable_hist = false;
 
 	return stats;
 }
@@ -8,6 +8,8 @@
 #include <linux/rcupdate.h>
 #include <linux/timer.h>
 
+struct blk_mq_hw_ctx;
+
 /**
  * struct blk_stat_callback - Block statistics callback.
  *
@@ -168,4 +170,46 @@ void blk_rq_stat_add(struct blk_rq_stat *, u64);
 void blk_rq_stat_sum(struct blk_rq_stat *, struct blk_rq_stat *);
 void blk_rq_stat_init(struct blk_rq_stat *);
 
+/*
+ * Completion latency histograms. Bucket 0 counts completions below 1us,
+ * bucket i covers [2^(i-1), 2^i) microseconds and the last bucket collects
+ * everything above.
+ */
+#define BLK_STAT_HIST_BUCKETS	24
+
+enum {
+	BLK_STAT_HIST_READ,
+	BLK_STAT_HIST_WRITE,
+	BLK_STAT_HIST_DISCARD,
+	BLK_STAT_HIST_FLUSH,
+	BLK_STAT_HIST_OPS,
+};
+
+struct blk_stat_hist {
+	u64 nr[BLK_STAT_HIST_OPS][BLK_STAT_HIST_BUCKETS];
+};
+
+/**
+ * blk_stat_enable_hist() - Start collecting per hardware queue latency
+ * histograms for a request queue.
+ * @q: The request queue.
+ *
+ * Return: 0 on success or -ENOMEM.
+ */
+int blk_stat_enable_hist(struct request_queue *q);
+void blk_stat_disable_hist(struct request_queue *q);
+
+/**
+ * blk_stat_hist_sum() - Add the per-cpu histograms of a hardware queue.
+ * @hctx: The hardware queue.
+ * @dst: Histogram the per-cpu counts are added to.
+ */
+void blk_stat_hist_sum(struct blk_mq_hw_ctx *hctx, struct blk_stat_hist *dst);
+void blk_stat_hist_reset(struct blk_mq_hw_ctx *hctx);
+
+static inline bool blk_stat_hist_enabled(struct request_queue *q)
+{
+	return test_bit(QUEUE_FLAG_LAT_HIST, &q->queue_flags);
+}
+
 #endif
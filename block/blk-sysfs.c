@@ -508,6 +508,49 @@ static ssize_t queue_wb_lat_store(struct request_queue *q, const char *page,
 	return count;
 }
 
+static ssize_t queue_discard_async_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_discard_queue_enabled(q), page);
+}
+
+static ssize_t queue_discard_async_store(struct request_queue *q,
+					 const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = blk_discard_queue_set_enabled(q, val);
+	return err ? err : ret;
+}
+
+static ssize_t queue_discard_async_idle_show(struct request_queue *q,
+					     char *page)
+{
+	return queue_var_show(blk_discard_queue_idle_ms(q), page);
+}
+
+static ssize_t queue_discard_async_idle_store(struct request_queue *q,
+					      const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	err = blk_discard_queue_set_idle_ms(q, val);
+	return err ? err : ret;
+}
+
 static ssize_t queue_wc_show(struct request_queue *q, char *page)
 {
 	if (test_bit(QUEUE_FLAG_WC, &q->queue_flags))
@@ -600,6 +643,8 @@ QUEUE_RO_ENTRY(queue_fua, "fua");
 QUEUE_RO_ENTRY(queue_dax, "dax");
 QUEUE_RW_ENTRY(queue_io_timeout, "io_timeout");
 QUEUE_RW_ENTRY(queue_wb_lat, "wbt_lat_usec");
+QUEUE_RW_ENTRY(queue_discard_async, "discard_async");
+QUEUE_RW_ENTRY(queue_discard_async_idle, "discard_async_idle_ms");
 
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 QUEUE_RW_ENTRY(blk_throtl_sample_time, "throttle_sample_time");
@@ -654,6 +699,8 @@ static struct attribute *queue_attrs[] = {
 	&queue_fua_entry.attr,
 	&queue_dax_entry.attr,
 	&queue_wb_lat_entry.attr,
+	&queue_discard_async_entry.attr,
+	&queue_discard_async_idle_entry.attr,
 	&queue_poll_delay_entry.attr,
 	&queue_io_timeout_entry.attr,
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
@@ -805,6 +852,7 @@ static void blk_release_queue(struct kobject *kobj)
 	blk_exit_queue(q);
 
 	blk_queue_free_zone_bitmaps(q);
+	blk_discard_queue_free(q);
 
 	if (queue_is_mq(q))
 		blk_mq_release(q);
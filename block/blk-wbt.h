@@ -65,6 +65,18 @@ struct rq_wb {
 	unsigned long last_issue;		/* last non-throttled issue */
 	unsigned long last_comp;		/* last non-throttled comp */
 	unsigned long min_lat_nsec;
+
+	/*
+	 * Counters exported through debugfs, reset by writing to "stats"
+	 */
+	struct {
+		unsigned long windows;		/* monitoring windows */
+		unsigned long lat_exceeded;	/* windows over min_lat_nsec */
+		unsigned long scale_up;
+		unsigned long scale_down;
+		unsigned long throttled;	/* bios that hit their limit */
+	} stats;
+
 	struct rq_qos rqos;
 	struct rq_wait rq_wait[WBT_NUM_RWQ];
 	struct rq_depth rq_depth;
@@ -448,4 +448,25 @@ int bio_add_hw_page(struct request_queue *q, struct bio *bio,
 		struct page *page, unsigned int len, unsigned int offset,
 		unsigned int max_sectors, bool *same_page);
 
+bool blk_discard_queue_add(struct block_device *bdev, sector_t sector,
+			   sector_t nr_sects);
+bool __blk_discard_queue_check_bio(struct blk_discard_queue *dq,
+				   struct bio *bio);
+bool blk_discard_queue_enabled(struct request_queue *q);
+int blk_discard_queue_set_enabled(struct request_queue *q, bool enable);
+unsigned int blk_discard_queue_idle_ms(struct request_queue *q);
+int blk_discard_queue_set_idle_ms(struct request_queue *q, unsigned int ms);
+void blk_discard_queue_exit(struct request_queue *q);
+void blk_discard_queue_free(struct request_queue *q);
+
+static inline bool blk_discard_queue_check_bio(struct request_queue *q,
+					       struct bio *bio)
+{
+	struct blk_discard_queue *dq = smp_load_acquire(&q->discard_queue);
+
+	if (likely(!dq))
+		return true;
+	return __blk_discard_queue_check_bio(dq, bio);
+}
+
 #endif /* BLK_INTERNAL_H */
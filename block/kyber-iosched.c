@@ -73,6 +73,27 @@ static const u64 kyber_latency_targets[] = {
 	[KYBER_DISCARD] = 5ULL * NSEC_PER_SEC,
 };
 
+/*
+ * With automatic latency targets, each domain's target is this multiple of the
+ * I/O latency observed while the device was (nearly) unloaded, clamped to
+ * [KYBER_MIN_AUTO_TARGET, KYBER_MAX_AUTO_SCALE * default target].
+ */
+static const unsigned int kyber_auto_target_mult[] = {
+	[KYBER_READ] = 4,
+	[KYBER_WRITE] = 8,
+	[KYBER_DISCARD] = 64,
+};
+
+enum {
+	/* A request is an unloaded sample if at most this many were in flight */
+	KYBER_UNLOADED_INFLIGHT = 1,
+	/* Minimum unloaded samples per window to update the estimate */
+	KYBER_MIN_UNLOADED_SAMPLES = 8,
+	KYBER_MAX_AUTO_SCALE = 16,
+};
+
+#define KYBER_MIN_AUTO_TARGET	(100ULL * NSEC_PER_USEC)
+
 /*
  * Batch size (number of requests we'll dispatch in a row) for each scheduling
  * domain.
@@ -132,6 +153,9 @@ static const char *kyber_latency_type_names[] = {
  */
 struct kyber_cpu_latency {
 	atomic_t buckets[KYBER_OTHER][2][KYBER_LATENCY_BUCKETS];
+	/* I/O latency of requests issued to an otherwise idle device */
+	atomic64_t unloaded_ns[KYBER_OTHER];
+	atomic_t unloaded_nr[KYBER_OTHER];
 };
 
 /*
@@ -175,6 +199,19 @@ struct kyber_queue_data {
 
 	/* Target latencies in nanoseconds. */
 	u64 latency_targets[KYBER_OTHER];
+
+	/* Derive latency_targets from unloaded_lat instead of sysfs. */
+	bool auto_targets;
+
+	/* Requests holding a domain token, across all domains. */
+	atomic_t inflight;
+
+	/* Moving average of the unloaded I/O latency, 0 if unknown. */
+	u64 unloaded_lat[KYBER_OTHER];
+
+	/* Latest percentile estimates (bucket upper bounds), 0 if unknown. */
+	u64 io_p90_ns[KYBER_OTHER];
+	u64 total_p99_ns[KYBER_OTHER];
 };
 
 struct kyber_hctx_data {
@@ -262,6 +299,49 @@ static int calculate_percentile(struct kyber_queue_data *kqd,
 	return bucket;
 }
 
+/* Upper bound in nanoseconds of latency histogram @bucket for @target */
+static u64 kyber_bucket_ns(u64 target, int bucket)
+{
+	return (target >> KYBER_LATENCY_SHIFT) * (bucket + 1);
+}
+
+static void kyber_update_unloaded(struct kyber_queue_data *kqd,
+				  unsigned int sched_domain, u64 sum,
+				  unsigned int nr)
+{
+	u64 lat, target, cur, min_target, max_target;
+
+	if (nr < KYBER_MIN_UNLOADED_SAMPLES)
+		return;
+
+	lat = div_u64(sum, nr);
+	if (kqd->unloaded_lat[sched_domain])
+		lat = div_u64(kqd->unloaded_lat[sched_domain] * 7 + lat, 8);
+	kqd->unloaded_lat[sched_domain] = lat;
+
+	if (!kqd->auto_targets)
+		return;
+
+	min_target = KYBER_MIN_AUTO_TARGET;
+	max_target = kyber_latency_targets[sched_domain] * KYBER_MAX_AUTO_SCALE;
+	target = clamp(lat * kyber_auto_target_mult[sched_domain],
+		       min_target, max_target);
+
+	/*
+	 * Ignore changes below 1/8 of the current target, there is no point
+	 * in throwing away the histogram for those.
+	 */
+	cur = kqd->latency_targets[sched_domain];
+	if ((target > cur ? target - cur : cur - target) < cur / 8)
+		return;
+
+	kqd->latency_targets[sched_domain] = target;
+	memset(kqd->latency_buckets[sched_domain], 0,
+	       sizeof(kqd->latency_buckets[sched_domain]));
+	kqd->latency_timeout[sched_domain] = 0;
+	kqd->domain_p99[sched_domain] = -1;
+}
+
 static void kyber_resize_domain(struct kyber_queue_data *kqd,
 				unsigned int sched_domain, unsigned int depth)
 {
@@ -276,6 +356,8 @@ static void kyber_resize_domain(struct kyber_queue_data *kqd,
 static void kyber_timer_fn(struct timer_list *t)
 {
 	struct kyber_queue_data *kqd = from_timer(kqd, t, timer);
+	u64 unloaded_ns[KYBER_OTHER] = { };
+	unsigned int unloaded_nr[KYBER_OTHER] = { };
 	unsigned int sched_domain;
 	int cpu;
 	bool bad = false;
@@ -290,9 +372,18 @@ static void kyber_timer_fn(struct timer_list *t)
 					      KYBER_TOTAL_LATENCY);
 			flush_latency_buckets(kqd, cpu_latency, sched_domain,
 					      KYBER_IO_LATENCY);
+			unloaded_nr[sched_domain] += atomic_xchg(
+				&cpu_latency->unloaded_nr[sched_domain], 0);
+			unloaded_ns[sched_domain] += atomic64_xchg(
+				&cpu_latency->unloaded_ns[sched_domain], 0);
 		}
 	}
 
+	for (sched_domain = 0; sched_domain < KYBER_OTHER; sched_domain++)
+		kyber_update_unloaded(kqd, sched_domain,
+				      unloaded_ns[sched_domain],
+				      unloaded_nr[sched_domain]);
+
 	/*
 	 * Check if any domains have a high I/O latency, which might indicate
 	 * congestion in the device. Note that we use the p90; we don't want to
@@ -305,6 +396,10 @@ static void kyber_timer_fn(struct timer_list *t)
 					   90);
 		if (p90 >= KYBER_GOOD_BUCKETS)
 			bad = true;
+		if (p90 >= 0)
+			WRITE_ONCE(kqd->io_p90_ns[sched_domain],
+				   kyber_bucket_ns(kqd->latency_targets[sched_domain],
+						   p90));
 	}
 
 	/*
@@ -318,6 +413,10 @@ static void kyber_timer_fn(struct timer_list *t)
 
 		p99 = calculate_percentile(kqd, sched_domain,
 					   KYBER_TOTAL_LATENCY, 99);
+		if (p99 >= 0)
+			WRITE_ONCE(kqd->total_p99_ns[sched_domain],
+				   kyber_bucket_ns(kqd->latency_targets[sched_domain],
+						   p99));
 		/*
 		 * This is kind of subtle: different domains will not
 		 * necessarily have enough samples to calculate the latency
@@ -546,9 +645,25 @@ static void rq_clear_domain_token(struct kyber_queue_data *kqd,
 		sched_domain = kyber_sched_domain(rq->cmd_flags);
 		sbitmap_queue_clear(&kqd->domain_tokens[sched_domain], nr,
 				    rq->mq_ctx->cpu);
+		rq_set_domain_token(rq, -1);
+		atomic_dec(&kqd->inflight);
 	}
 }
 
+/*
+ * Hand @rq its domain token, and remember whether it was issued to an
+ * otherwise idle device so its latency can feed the unloaded estimate.
+ */
+static void kyber_start_request(struct kyber_queue_data *kqd,
+				struct request *rq, int token)
+{
+	bool unloaded;
+
+	rq_set_domain_token(rq, token);
+	unloaded = atomic_inc_return(&kqd->inflight) <= KYBER_UNLOADED_INFLIGHT;
+	rq->elv.priv[1] = (void *)(long)unloaded;
+}
+
 static void kyber_limit_depth(unsigned int op, struct blk_mq_alloc_data *data)
 {
 	/*
@@ -583,6 +698,7 @@ static bool kyber_bio_merge(struct request_queue *q, struct bio *bio,
 static void kyber_prepare_request(struct request *rq)
 {
 	rq_set_domain_token(rq, -1);
+	rq->elv.priv[1] = NULL;
 }
 
 static void kyber_insert_requests(struct blk_mq_hw_ctx *hctx,
@@ -650,6 +766,11 @@ static void kyber_completed_request(struct request *rq, u64 now)
 			   target, now - rq->start_time_ns);
 	add_latency_sample(cpu_latency, sched_domain, KYBER_IO_LATENCY, target,
 			   now - rq->io_start_time_ns);
+	if (rq->elv.priv[1] && now > rq->io_start_time_ns) {
+		atomic64_add(now - rq->io_start_time_ns,
+			     &cpu_latency->unloaded_ns[sched_domain]);
+		atomic_inc(&cpu_latency->unloaded_nr[sched_domain]);
+	}
 	put_cpu_ptr(kqd->cpu_latency);
 
 	timer_reduce(&kqd->timer, jiffies + HZ / 10);
@@ -771,7 +892,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 		nr = kyber_get_domain_token(kqd, khd, hctx);
 		if (nr >= 0) {
 			khd->batching++;
-			rq_set_domain_token(rq, nr);
+			kyber_start_request(kqd, rq, nr);
 			list_del_init(&rq->queuelist);
 			return rq;
 		} else {
@@ -784,7 +905,7 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 			kyber_flush_busy_kcqs(khd, khd->cur_domain, rqs);
 			rq = list_first_entry(rqs, struct request, queuelist);
 			khd->batching++;
-			rq_set_domain_token(rq, nr);
+			kyber_start_request(kqd, rq, nr);
 			list_del_init(&rq->queuelist);
 			return rq;
 		} else {
@@ -877,18 +998,86 @@ static ssize_t kyber_##name##_lat_store(struct elevator_queue *e,	\
 	if (ret)							\
 		return ret;						\
 									\
+	/* An explicit target overrides automatic tuning. */		\
+	kqd->auto_targets = false;					\
 	kqd->latency_targets[domain] = nsec;				\
 									\
 	return count;							\
+}									\
+									\
+static ssize_t kyber_##name##_depth_show(struct elevator_queue *e,	\
+					 char *page)			\
+{									\
+	struct kyber_queue_data *kqd = e->elevator_data;		\
+									\
+	return sprintf(page, "%u\n",					\
+		       READ_ONCE(kqd->domain_tokens[domain].sb.depth));	\
+}									\
+									\
+static ssize_t kyber_##name##_p90_show(struct elevator_queue *e,	\
+				       char *page)			\
+{									\
+	struct kyber_queue_data *kqd = e->elevator_data;		\
+									\
+	return sprintf(page, "%llu\n", READ_ONCE(kqd->io_p90_ns[domain])); \
+}									\
+									\
+static ssize_t kyber_##name##_p99_show(struct elevator_queue *e,	\
+				       char *page)			\
+{									\
+	struct kyber_queue_data *kqd = e->elevator_data;		\
+									\
+	return sprintf(page, "%llu\n",					\
+		       READ_ONCE(kqd->total_p99_ns[domain]));		\
 }
 KYBER_LAT_SHOW_STORE(KYBER_READ, read);
 KYBER_LAT_SHOW_STORE(KYBER_WRITE, write);
+KYBER_LAT_SHOW_STORE(KYBER_DISCARD, discard);
 #undef KYBER_LAT_SHOW_STORE
 
-#define KYBER_LAT_ATTR(op) __ATTR(op##_lat_nsec, 0644, kyber_##op##_lat_show, kyber_##op##_lat_store)
+static ssize_t kyber_auto_lat_show(struct elevator_queue *e, char *page)
+{
+	struct kyber_queue_data *kqd = e->elevator_data;
+
+	return sprintf(page, "%d\n", kqd->auto_targets);
+}
+
+static ssize_t kyber_auto_lat_store(struct elevator_queue *e,
+				    const char *page, size_t count)
+{
+	struct kyber_queue_data *kqd = e->elevator_data;
+	unsigned int sched_domain;
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(page, &enable);
+	if (ret)
+		return ret;
+
+	/*
+	 * Leaving auto mode drops the learned targets.  Writing 0 while
+	 * already manual must not clobber targets the user configured.
+	 */
+	if (kqd->auto_targets && !enable) {
+		for (sched_domain = 0; sched_domain < KYBER_OTHER; sched_domain++)
+			kqd->latency_targets[sched_domain] =
+				kyber_latency_targets[sched_domain];
+	}
+	kqd->auto_targets = enable;
+	return count;
+}
+
+#define KYBER_LAT_ATTR(op)						\
+	__ATTR(op##_lat_nsec, 0644, kyber_##op##_lat_show,		\
+	       kyber_##op##_lat_store),					\
+	__ATTR(op##_depth, 0444, kyber_##op##_depth_show, NULL),	\
+	__ATTR(op##_io_p90_nsec, 0444, kyber_##op##_p90_show, NULL),	\
+	__ATTR(op##_total_p99_nsec, 0444, kyber_##op##_p99_show, NULL)
 static struct elv_fs_entry kyber_sched_attrs[] = {
 	KYBER_LAT_ATTR(read),
 	KYBER_LAT_ATTR(write),
+	KYBER_LAT_ATTR(discard),
+	__ATTR(auto_lat, 0644, kyber_auto_lat_show, kyber_auto_lat_store),
 	__ATTR_NULL
 };
 #undef KYBER_LAT_ATTR
@@ -963,6 +1152,18 @@ static int kyber_async_depth_show(void *data, struct seq_file *m)
 	return 0;
 }
 
+static int kyber_unloaded_lat_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct kyber_queue_data *kqd = q->elevator->elevator_data;
+	unsigned int sched_domain;
+
+	for (sched_domain = 0; sched_domain < KYBER_OTHER; sched_domain++)
+		seq_printf(m, "%s %llu\n", kyber_domain_names[sched_domain],
+			   kqd->unloaded_lat[sched_domain]);
+	return 0;
+}
+
 static int kyber_cur_domain_show(void *data, struct seq_file *m)
 {
 	struct blk_mq_hw_ctx *hctx = data;
@@ -989,6 +1190,7 @@ static const struct blk_mq_debugfs_attr kyber_queue_debugfs_attrs[] = {
 	KYBER_QUEUE_DOMAIN_ATTRS(discard),
 	KYBER_QUEUE_DOMAIN_ATTRS(other),
 	{"async_depth", 0400, kyber_async_depth_show},
+	{"unloaded_lat", 0400, kyber_unloaded_lat_show},
 	{},
 };
 #undef KYBER_QUEUE_DOMAIN_ATTRS
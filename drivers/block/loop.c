@@ -88,6 +88,9 @@ static DEFINE_MUTEX(loop_ctl_mutex);
 
 static int max_part;
 static int part_shift;
+static unsigned int nr_hw_queues = 1;
+static unsigned int hw_queue_depth = 128;
+static bool direct_io;
 
 static int transfer_xor(struct loop_device *lo, int cmd,
 			struct page *raw_page, unsigned raw_off,
@@ -915,8 +918,12 @@ static void loop_config_discard(struct loop_device *lo)
 
 static void loop_unprepare_queue(struct loop_device *lo)
 {
-	kthread_flush_worker(&lo->worker);
-	kthread_stop(lo->worker_task);
+	unsigned int i;
+
+	for (i = 0; i < lo->tag_set.nr_hw_queues; i++) {
+		kthread_flush_worker(&lo->workers[i].worker);
+		kthread_stop(lo->workers[i].worker_task);
+	}
 }
 
 static int loop_kthread_worker_fn(void *worker_ptr)
@@ -925,15 +932,37 @@ static int loop_kthread_worker_fn(void *worker_ptr)
 	return kthread_worker_fn(worker_ptr);
 }
 
+static void loop_process_work(struct kthread_work *work);
+
 static int loop_prepare_queue(struct loop_device *lo)
 {
-	kthread_init_worker(&lo->worker);
-	lo->worker_task = kthread_run(loop_kthread_worker_fn,
-			&lo->worker, "loop%d", lo->lo_number);
-	if (IS_ERR(lo->worker_task))
-		return -ENOMEM;
-	set_user_nice(lo->worker_task, MIN_NICE);
+	unsigned int nr = lo->tag_set.nr_hw_queues;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		struct loop_worker *w = &lo->workers[i];
+
+		kthread_init_worker(&w->worker);
+		kthread_init_work(&w->work, loop_process_work);
+		spin_lock_init(&w->lock);
+		INIT_LIST_HEAD(&w->cmd_list);
+		if (nr == 1)
+			w->worker_task = kthread_run(loop_kthread_worker_fn,
+					&w->worker, "loop%d", lo->lo_number);
+		else
+			w->worker_task = kthread_run(loop_kthread_worker_fn,
+					&w->worker, "loop%d/%u",
+					lo->lo_number, i);
+		if (IS_ERR(w->worker_task))
+			goto out_stop;
+		set_user_nice(w->worker_task, MIN_NICE);
+	}
 	return 0;
+
+out_stop:
+	while (i--)
+		kthread_stop(lo->workers[i].worker_task);
+	return -ENOMEM;
 }
 
 static void loop_update_rotational(struct loop_device *lo)
@@ -1071,6 +1100,7 @@ static int loop_configure(struct loop_device *lo, fmode_t mode,
 	int		error;
 	loff_t		size;
 	bool		partscan;
+	bool		dio;
 	unsigned short  bsize;
 
 	/* This is safe, since we have a reference from open(). */
@@ -1132,7 +1162,14 @@ static int loop_configure(struct loop_device *lo, fmode_t mode,
 
 	set_device_ro(bdev, (lo->lo_flags & LO_FLAGS_READ_ONLY) != 0);
 
-	lo->use_dio = lo->lo_flags & LO_FLAGS_DIRECT_IO;
+	/*
+	 * Start out buffered and let __loop_update_dio() below switch to
+	 * direct I/O, so that request merging gets enabled along with it.
+	 */
+	dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO) || direct_io ||
+	      (file->f_flags & O_DIRECT);
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	lo->use_dio = false;
 	lo->lo_device = bdev;
 	lo->lo_backing_file = file;
 	lo->old_gfp_mask = mapping_gfp_mask(mapping);
@@ -1155,7 +1192,7 @@ static int loop_configure(struct loop_device *lo, fmode_t mode,
 
 	loop_config_discard(lo);
 	loop_update_rotational(lo);
-	loop_update_dio(lo);
+	__loop_update_dio(lo, dio);
 	loop_sysfs_init(lo);
 
 	size = get_loop_size(lo, file);
@@ -1796,6 +1833,12 @@ module_param(max_loop, int, 0444);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, 0444);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(nr_hw_queues, uint, 0444);
+MODULE_PARM_DESC(nr_hw_queues, "Number of hardware queues per loop device, each served by its own worker thread. Default: 1");
+module_param(hw_queue_depth, uint, 0444);
+MODULE_PARM_DESC(hw_queue_depth, "Queue depth for each hardware queue. Default: 128");
+module_param(direct_io, bool, 0444);
+MODULE_PARM_DESC(direct_io, "Access the backing file with direct I/O whenever it supports it. Default: false");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1843,6 +1886,7 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 	struct request *rq = bd->rq;
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
 	struct loop_device *lo = rq->q->queuedata;
+	struct loop_worker *w = hctx->driver_data;
 
 	blk_mq_start_request(rq);
 
@@ -1868,7 +1912,11 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 	} else
 #endif
 		cmd->css = NULL;
-	kthread_queue_work(&lo->worker, &cmd->work);
+
+	spin_lock(&w->lock);
+	list_add_tail(&cmd->list_entry, &w->cmd_list);
+	spin_unlock(&w->lock);
+	kthread_queue_work(&w->worker, &w->work);
 
 	return BLK_STS_OK;
 }
@@ -1898,26 +1946,48 @@ static void loop_handle_cmd(struct loop_cmd *cmd)
 	}
 }
 
-static void loop_queue_work(struct kthread_work *work)
+/*
+ * Drain everything queued to this worker's hw queue. The plug lets the
+ * backing device see the whole batch at once in direct I/O mode.
+ */
+static void loop_process_work(struct kthread_work *work)
 {
-	struct loop_cmd *cmd =
-		container_of(work, struct loop_cmd, work);
+	struct loop_worker *w = container_of(work, struct loop_worker, work);
+	struct blk_plug plug;
+	LIST_HEAD(cmd_list);
+
+	blk_start_plug(&plug);
+	spin_lock(&w->lock);
+	while (!list_empty(&w->cmd_list)) {
+		list_splice_init(&w->cmd_list, &cmd_list);
+		spin_unlock(&w->lock);
+
+		while (!list_empty(&cmd_list)) {
+			struct loop_cmd *cmd = list_first_entry(&cmd_list,
+					struct loop_cmd, list_entry);
+
+			list_del_init(&cmd->list_entry);
+			loop_handle_cmd(cmd);
+		}
 
-	loop_handle_cmd(cmd);
+		spin_lock(&w->lock);
+	}
+	spin_unlock(&w->lock);
+	blk_finish_plug(&plug);
 }
 
-static int loop_init_request(struct blk_mq_tag_set *set, struct request *rq,
-		unsigned int hctx_idx, unsigned int numa_node)
+static int loop_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
 {
-	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	struct loop_device *lo = data;
 
-	kthread_init_work(&cmd->work, loop_queue_work);
+	hctx->driver_data = &lo->workers[hctx_idx];
 	return 0;
 }
 
 static const struct blk_mq_ops loop_mq_ops = {
 	.queue_rq       = loop_queue_rq,
-	.init_request	= loop_init_request,
+	.init_hctx	= loop_init_hctx,
 	.complete	= lo_complete_rq,
 };
 
@@ -1948,8 +2018,9 @@ static int loop_add(struct loop_device **l, int i)
 
 	err = -ENOMEM;
 	lo->tag_set.ops = &loop_mq_ops;
-	lo->tag_set.nr_hw_queues = 1;
-	lo->tag_set.queue_depth = 128;
+	/* a worker thread per hw queue, more queues than CPUs buy nothing */
+	lo->tag_set.nr_hw_queues = clamp(nr_hw_queues, 1U, nr_cpu_ids);
+	lo->tag_set.queue_depth = hw_queue_depth ?: 128;
 	lo->tag_set.numa_node = NUMA_NO_NODE;
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
 	lo->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_STACKING |
@@ -1960,10 +2031,16 @@ static int loop_add(struct loop_device **l, int i)
 	if (err)
 		goto out_free_idr;
 
+	err = -ENOMEM;
+	lo->workers = kcalloc(lo->tag_set.nr_hw_queues, sizeof(*lo->workers),
+			      GFP_KERNEL);
+	if (!lo->workers)
+		goto out_cleanup_tags;
+
 	lo->lo_queue = blk_mq_init_queue(&lo->tag_set);
 	if (IS_ERR(lo->lo_queue)) {
 		err = PTR_ERR(lo->lo_queue);
-		goto out_cleanup_tags;
+		goto out_free_workers;
 	}
 	lo->lo_queue->queuedata = lo;
 
@@ -2018,6 +2095,8 @@ static int loop_add(struct loop_device **l, int i)
 
 out_free_queue:
 	blk_cleanup_queue(lo->lo_queue);
+out_free_workers:
+	kfree(lo->workers);
 out_cleanup_tags:
 	blk_mq_free_tag_set(&lo->tag_set);
 out_free_idr:
@@ -2034,6 +2113,7 @@ static void loop_remove(struct loop_device *lo)
 	blk_cleanup_queue(lo->lo_queue);
 	blk_mq_free_tag_set(&lo->tag_set);
 	put_disk(lo->lo_disk);
+	kfree(lo->workers);
 	kfree(lo);
 }
 
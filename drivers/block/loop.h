@@ -26,6 +26,18 @@ enum {
 
 struct loop_func_table;
 
+/*
+ * Commands queued to a hardware queue are handed to its worker through
+ * cmd_list, and the worker drains the list in one go.
+ */
+struct loop_worker {
+	struct kthread_worker	worker;
+	struct task_struct	*worker_task;
+	struct kthread_work	work;
+	spinlock_t		lock;
+	struct list_head	cmd_list;
+};
+
 struct loop_device {
 	int		lo_number;
 	atomic_t	lo_refcnt;
@@ -54,8 +66,7 @@ struct loop_device {
 
 	spinlock_t		lo_lock;
 	int			lo_state;
-	struct kthread_worker	worker;
-	struct task_struct	*worker_task;
+	struct loop_worker	*workers;	/* one per hw queue */
 	bool			use_dio;
 	bool			sysfs_inited;
 
@@ -65,7 +76,7 @@ struct loop_device {
 };
 
 struct loop_cmd {
-	struct kthread_work work;
+	struct list_head list_entry;
 	bool use_aio; /* use AIO interface to handle I/O */
 	atomic_t ref; /* only for aio */
 	long ret;
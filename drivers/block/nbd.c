@@ -59,6 +59,11 @@ struct nbd_sock {
 	bool dead;
 	int fallback_index;
 	int cookie;
+	/*
+	 * Requests sent and not yet replied to. Only a load balancing hint,
+	 * it is reset when the connection dies.
+	 */
+	atomic_t inflight;
 };
 
 struct recv_thread_args {
@@ -122,6 +127,7 @@ struct nbd_device {
 };
 
 #define NBD_CMD_REQUEUED	1
+#define NBD_CMD_INFLIGHT	2	/* counted in socks[index]->inflight */
 
 struct nbd_cmd {
 	struct nbd_device *nbd;
@@ -161,6 +167,24 @@ static inline struct device *nbd_to_dev(struct nbd_device *nbd)
 	return disk_to_dev(nbd->disk);
 }
 
+/*
+ * Drop @cmd from the inflight hint of the connection it was sent on, once its
+ * reply has arrived or has been given up on.  Counts of an older incarnation
+ * of the connection were already reset when it died.
+ */
+static void nbd_cmd_uncount(struct nbd_config *config, struct nbd_cmd *cmd)
+{
+	struct nbd_sock *nsock;
+
+	if (!test_and_clear_bit(NBD_CMD_INFLIGHT, &cmd->flags))
+		return;
+	if (cmd->index >= config->num_connections)
+		return;
+	nsock = config->socks[cmd->index];
+	if (cmd->cookie == READ_ONCE(nsock->cookie))
+		atomic_dec_if_positive(&nsock->inflight);
+}
+
 static void nbd_requeue_cmd(struct nbd_cmd *cmd)
 {
 	struct request *req = blk_mq_rq_from_pdu(cmd);
@@ -285,6 +309,7 @@ static void nbd_mark_nsock_dead(struct nbd_device *nbd, struct nbd_sock *nsock,
 	nsock->dead = true;
 	nsock->pending = NULL;
 	nsock->sent = 0;
+	atomic_set(&nsock->inflight, 0);
 }
 
 static void nbd_size_clear(struct nbd_device *nbd)
@@ -412,6 +437,7 @@ static enum blk_eh_timer_return nbd_xmit_timeout(struct request *req,
 			if (cmd->index < config->num_connections) {
 				struct nbd_sock *nsock =
 					config->socks[cmd->index];
+				nbd_cmd_uncount(config, cmd);
 				mutex_lock(&nsock->tx_lock);
 				/* We can have multiple outstanding requests, so
 				 * we don't want to mark the nsock dead if we've
@@ -444,6 +470,7 @@ static enum blk_eh_timer_return nbd_xmit_timeout(struct request *req,
 
 		mutex_lock(&nsock->tx_lock);
 		if (cmd->cookie != nsock->cookie) {
+			nbd_cmd_uncount(config, cmd);
 			nbd_requeue_cmd(cmd);
 			mutex_unlock(&nsock->tx_lock);
 			mutex_unlock(&cmd->lock);
@@ -458,6 +485,7 @@ static enum blk_eh_timer_return nbd_xmit_timeout(struct request *req,
 
 	dev_err_ratelimited(nbd_to_dev(nbd), "Connection timed out\n");
 	set_bit(NBD_RT_TIMEDOUT, &config->runtime_flags);
+	nbd_cmd_uncount(config, cmd);
 	cmd->status = BLK_STS_IOERR;
 	mutex_unlock(&cmd->lock);
 	sock_shutdown(nbd);
@@ -745,11 +773,24 @@ static struct nbd_cmd *nbd_read_stat(struct nbd_device *nbd, int index)
 
 	dev_dbg(nbd_to_dev(nbd), "request %p: got reply\n", req);
 	if (rq_data_dir(req) != WRITE) {
-		struct req_iterator iter;
-		struct bio_vec bvec;
+		struct bio *bio;
 
-		rq_for_each_segment(bvec, req, iter) {
-			iov_iter_bvec(&to, READ, &bvec, 1, bvec.bv_len);
+		/*
+		 * Receive each bio's payload straight into its pages with a
+		 * single recvmsg over the bio's bvec table.
+		 */
+		__rq_for_each_bio(bio, req) {
+			struct bvec_iter iter;
+			struct bio_vec bvec;
+			unsigned int nr_bvec = 0;
+
+			bio_for_each_bvec(bvec, bio, iter)
+				nr_bvec++;
+
+			iov_iter_bvec(&to, READ,
+				      __bvec_iter_bvec(bio->bi_io_vec, bio->bi_iter),
+				      nr_bvec, bio->bi_iter.bi_size);
+			to.iov_offset = bio->bi_iter.bi_bvec_done;
 			result = sock_xmit(nbd, index, 0, &to, MSG_WAITALL, NULL);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk), "Receive data failed (result %d)\n",
@@ -767,8 +808,8 @@ static struct nbd_cmd *nbd_read_stat(struct nbd_device *nbd, int index)
 				ret = -EIO;
 				goto out;
 			}
-			dev_dbg(nbd_to_dev(nbd), "request %p: got %d bytes data\n",
-				req, bvec.bv_len);
+			dev_dbg(nbd_to_dev(nbd), "request %p: got %u bytes data\n",
+				req, bio->bi_iter.bi_size);
 		}
 	}
 out:
@@ -797,6 +838,7 @@ static void recv_work(struct work_struct *work)
 			mutex_unlock(&nsock->tx_lock);
 			break;
 		}
+		nbd_cmd_uncount(config, cmd);
 
 		rq = blk_mq_rq_from_pdu(cmd);
 		if (likely(!blk_should_fake_timeout(rq->q)))
@@ -875,6 +917,44 @@ static int find_fallback(struct nbd_device *nbd, int index)
 	return new_index;
 }
 
+/*
+ * Pick the live connection with the fewest requests awaiting a reply,
+ * preferring @index, the connection of the submitting hw queue, on ties.
+ * Connections stuck behind a partially sent request are avoided, and a
+ * partially sent @req always goes back to the connection it started on.
+ */
+static int nbd_select_sock(struct nbd_config *config, struct nbd_cmd *cmd,
+			   int index)
+{
+	struct request *req = blk_mq_rq_from_pdu(cmd);
+	int best = index;
+	int best_inflight;
+	int i;
+
+	if (cmd->index < config->num_connections &&
+	    READ_ONCE(config->socks[cmd->index]->pending) == req)
+		return cmd->index;
+
+	if (READ_ONCE(config->socks[index]->pending))
+		best_inflight = INT_MAX;
+	else
+		best_inflight = atomic_read(&config->socks[index]->inflight);
+
+	for (i = 0; i < config->num_connections && best_inflight > 0; i++) {
+		struct nbd_sock *nsock = config->socks[i];
+		int inflight;
+
+		if (READ_ONCE(nsock->dead) || READ_ONCE(nsock->pending))
+			continue;
+		inflight = atomic_read(&nsock->inflight);
+		if (inflight < best_inflight) {
+			best = i;
+			best_inflight = inflight;
+		}
+	}
+	return best;
+}
+
 static int wait_for_reconnect(struct nbd_device *nbd)
 {
 	struct nbd_config *config = nbd->config;
@@ -915,6 +995,8 @@ static int nbd_handle_cmd(struct nbd_cmd *cmd, int index)
 		return -EINVAL;
 	}
 	cmd->status = BLK_STS_OK;
+	if (config->num_connections > 1)
+		index = nbd_select_sock(config, cmd, index);
 again:
 	nsock = config->socks[index];
 	mutex_lock(&nsock->tx_lock);
@@ -957,6 +1039,10 @@ static int nbd_handle_cmd(struct nbd_cmd *cmd, int index)
 	 * returns EAGAIN can be retried on a different socket.
 	 */
 	ret = nbd_send_cmd(nbd, cmd, index);
+	if (!ret) {
+		set_bit(NBD_CMD_INFLIGHT, &cmd->flags);
+		atomic_inc(&nsock->inflight);
+	}
 	if (ret == -EAGAIN) {
 		dev_err_ratelimited(disk_to_dev(nbd->disk),
 				    "Request send failed, requeueing\n");
@@ -987,6 +1073,7 @@ static blk_status_t nbd_queue_rq(struct blk_mq_hw_ctx *hctx,
 	 */
 	mutex_lock(&cmd->lock);
 	clear_bit(NBD_CMD_REQUEUED, &cmd->flags);
+	clear_bit(NBD_CMD_INFLIGHT, &cmd->flags);
 
 	/* We can be called directly from the user space process, which means we
 	 * could possibly have signals pending so our sendmsg will fail.  In
@@ -1078,6 +1165,7 @@ static int nbd_add_socket(struct nbd_device *nbd, unsigned long arg,
 	nsock->pending = NULL;
 	nsock->sent = 0;
 	nsock->cookie = 0;
+	atomic_set(&nsock->inflight, 0);
 	socks[config->num_connections++] = nsock;
 	atomic_inc(&config->live_connections);
 	blk_mq_unfreeze_queue(nbd->disk->queue);
@@ -1132,6 +1220,7 @@ static int nbd_reconnect_socket(struct nbd_device *nbd, unsigned long arg)
 		args->index = i;
 		args->nbd = nbd;
 		nsock->cookie++;
+		atomic_set(&nsock->inflight, 0);
 		mutex_unlock(&nsock->tx_lock);
 		sockfd_put(old);
 
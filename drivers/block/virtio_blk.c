@@ -15,6 +15,8 @@
 #include <linux/blk-mq.h>
 #include <linux/blk-mq-virtio.h>
 #include <linux/numa.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <uapi/linux/virtio_ring.h>
 
 #define PART_BITS 4
@@ -24,12 +26,30 @@
 static int major;
 static DEFINE_IDA(vd_index_ida);
 
+/*
+ * Don't kick the device for new requests while at least this many earlier
+ * requests it has been told about are still outstanding. The next
+ * completion kicks instead, which saves a VM exit per batch when the
+ * device is busy anyway. 0 kicks at the end of every batch.
+ */
+static unsigned int virtblk_kick_defer_depth = 8;
+module_param_named(kick_defer_depth, virtblk_kick_defer_depth, uint, 0644);
+
 static struct workqueue_struct *virtblk_wq;
 
 struct virtio_blk_vq {
 	struct virtqueue *vq;
 	spinlock_t lock;
 	char name[VQ_NAME_LEN];
+
+	/* the fields below are protected by lock */
+	unsigned int inflight;		/* added and not yet completed */
+	unsigned int unkicked;		/* added since the last kick */
+
+	unsigned long kicks;		/* notifications sent to the device */
+	unsigned long kicks_deferred;	/* kicks left to the next completion */
+	unsigned long interrupts;	/* virtblk_done() invocations */
+	unsigned long completions;
 } ____cacheline_aligned_in_smp;
 
 struct virtio_blk {
@@ -69,6 +89,11 @@ struct virtio_blk {
 	/* num of vqs */
 	int num_vqs;
 	struct virtio_blk_vq *vqs;
+
+#ifdef CONFIG_BLK_DEBUG_FS
+	/* per-vq counters, in the queue's debugfs directory */
+	struct dentry *debugfs_vq_stats;
+#endif
 };
 
 struct virtblk_req {
@@ -171,33 +196,73 @@ static inline void virtblk_request_done(struct request *req)
 	blk_mq_end_request(req, virtblk_result(vbr));
 }
 
+static void virtblk_complete_batch(struct io_comp_batch *iob)
+{
+	blk_mq_end_request_batch(iob);
+}
+
+/* Must be called with the vq lock held. */
+static bool virtblk_kick_prepare(struct virtio_blk_vq *vq)
+{
+	vq->unkicked = 0;
+	if (!virtqueue_kick_prepare(vq->vq))
+		return false;
+	vq->kicks++;
+	return true;
+}
+
 static void virtblk_done(struct virtqueue *vq)
 {
 	struct virtio_blk *vblk = vq->vdev->priv;
+	DEFINE_IO_COMP_BATCH(iob);
 	bool req_done = false;
+	bool notify = false;
 	int qid = vq->index;
+	struct virtio_blk_vq *bvq = &vblk->vqs[qid];
 	struct virtblk_req *vbr;
 	unsigned long flags;
 	unsigned int len;
 
-	spin_lock_irqsave(&vblk->vqs[qid].lock, flags);
+	spin_lock_irqsave(&bvq->lock, flags);
+	bvq->interrupts++;
 	do {
 		virtqueue_disable_cb(vq);
 		while ((vbr = virtqueue_get_buf(vblk->vqs[qid].vq, &len)) != NULL) {
 			struct request *req = blk_mq_rq_from_pdu(vbr);
 
-			if (likely(!blk_should_fake_timeout(req->q)))
-				blk_mq_complete_request(req);
+			if (likely(!blk_should_fake_timeout(req->q))) {
+				/* discards have a payload to free */
+				if ((req->rq_flags & RQF_SPECIAL_PAYLOAD) ||
+				    !blk_mq_add_to_batch(req, &iob,
+						virtblk_result(vbr),
+						virtblk_complete_batch))
+					blk_mq_complete_request(req);
+			}
+			bvq->completions++;
+			if (bvq->inflight)
+				bvq->inflight--;
 			req_done = true;
 		}
 		if (unlikely(virtqueue_is_broken(vq)))
 			break;
 	} while (!virtqueue_enable_cb(vq));
 
+	/* the device may have picked up unkicked requests on its own */
+	bvq->unkicked = min(bvq->unkicked, bvq->inflight);
+	/* send the kick deferred by virtio_queue_rq() */
+	if (bvq->unkicked)
+		notify = virtblk_kick_prepare(bvq);
+
 	/* In case queue is stopped waiting for more buffers. */
 	if (req_done)
 		blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
-	spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
+	spin_unlock_irqrestore(&bvq->lock, flags);
+
+	if (notify)
+		virtqueue_notify(vq);
+
+	if (!list_empty(&iob.req_list))
+		iob.complete(&iob);
 }
 
 static void virtio_commit_rqs(struct blk_mq_hw_ctx *hctx)
@@ -207,7 +272,7 @@ static void virtio_commit_rqs(struct blk_mq_hw_ctx *hctx)
 	bool kick;
 
 	spin_lock_irq(&vq->lock);
-	kick = virtqueue_kick_prepare(vq->vq);
+	kick = virtblk_kick_prepare(vq);
 	spin_unlock_irq(&vq->lock);
 
 	if (kick)
@@ -223,6 +288,8 @@ static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 	unsigned long flags;
 	unsigned int num;
 	int qid = hctx->queue_num;
+	struct virtio_blk_vq *vq = &vblk->vqs[qid];
+	unsigned int defer_depth;
 	int err;
 	bool notify = false;
 	bool unmap = false;
@@ -274,16 +341,17 @@ static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 			vbr->out_hdr.type |= cpu_to_virtio32(vblk->vdev, VIRTIO_BLK_T_IN);
 	}
 
-	spin_lock_irqsave(&vblk->vqs[qid].lock, flags);
-	err = virtblk_add_req(vblk->vqs[qid].vq, vbr, vbr->sg, num);
+	spin_lock_irqsave(&vq->lock, flags);
+	err = virtblk_add_req(vq->vq, vbr, vbr->sg, num);
 	if (err) {
-		virtqueue_kick(vblk->vqs[qid].vq);
+		if (virtblk_kick_prepare(vq))
+			virtqueue_notify(vq->vq);
 		/* Don't stop the queue if -ENOMEM: we may have failed to
 		 * bounce the buffer due to global resource outage.
 		 */
 		if (err == -ENOSPC)
 			blk_mq_stop_hw_queue(hctx);
-		spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
+		spin_unlock_irqrestore(&vq->lock, flags);
 		switch (err) {
 		case -ENOSPC:
 			return BLK_STS_DEV_RESOURCE;
@@ -294,12 +362,23 @@ static blk_status_t virtio_queue_rq(struct blk_mq_hw_ctx *hctx,
 		}
 	}
 
-	if (bd->last && virtqueue_kick_prepare(vblk->vqs[qid].vq))
-		notify = true;
-	spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
+	vq->inflight++;
+	vq->unkicked++;
+	if (bd->last) {
+		/*
+		 * Leave the kick to virtblk_done() if enough requests the
+		 * device already knows about are outstanding.
+		 */
+		defer_depth = READ_ONCE(virtblk_kick_defer_depth);
+		if (defer_depth && vq->inflight - vq->unkicked >= defer_depth)
+			vq->kicks_deferred++;
+		else
+			notify = virtblk_kick_prepare(vq);
+	}
+	spin_unlock_irqrestore(&vq->lock, flags);
 
 	if (notify)
-		virtqueue_notify(vblk->vqs[qid].vq);
+		virtqueue_notify(vq->vq);
 	return BLK_STS_OK;
 }
 
@@ -435,6 +514,42 @@ static ssize_t serial_show(struct device *dev,
 
 static DEVICE_ATTR_RO(serial);
 
+#ifdef CONFIG_BLK_DEBUG_FS
+static int virtblk_vq_stats_show(struct seq_file *m, void *v)
+{
+	struct virtio_blk *vblk = m->private;
+	int i;
+
+	for (i = 0; i < vblk->num_vqs; i++) {
+		struct virtio_blk_vq *vq = &vblk->vqs[i];
+
+		seq_printf(m, "%s kicks=%lu deferred=%lu interrupts=%lu completions=%lu\n",
+			   vq->name, READ_ONCE(vq->kicks),
+			   READ_ONCE(vq->kicks_deferred),
+			   READ_ONCE(vq->interrupts),
+			   READ_ONCE(vq->completions));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(virtblk_vq_stats);
+
+static void virtblk_debugfs_register(struct virtio_blk *vblk)
+{
+	vblk->debugfs_vq_stats = debugfs_create_file("vq_stats", 0400,
+					vblk->disk->queue->debugfs_dir, vblk,
+					&virtblk_vq_stats_fops);
+}
+
+static void virtblk_debugfs_unregister(struct virtio_blk *vblk)
+{
+	debugfs_remove(vblk->debugfs_vq_stats);
+	vblk->debugfs_vq_stats = NULL;
+}
+#else
+static inline void virtblk_debugfs_register(struct virtio_blk *vblk) { }
+static inline void virtblk_debugfs_unregister(struct virtio_blk *vblk) { }
+#endif
+
 /* The queue's logical block size must be set before calling this */
 static void virtblk_update_capacity(struct virtio_blk *vblk, bool resize)
 {
@@ -507,7 +622,7 @@ static int init_vq(struct virtio_blk *vblk)
 
 	num_vqs = min_t(unsigned int, nr_cpu_ids, num_vqs);
 
-	vblk->vqs = kmalloc_array(num_vqs, sizeof(*vblk->vqs), GFP_KERNEL);
+	vblk->vqs = kcalloc(num_vqs, sizeof(*vblk->vqs), GFP_KERNEL);
 	if (!vblk->vqs)
 		return -ENOMEM;
 
@@ -901,6 +1016,7 @@ static int virtblk_probe(struct virtio_device *vdev)
 	virtio_device_ready(vdev);
 
 	device_add_disk(&vdev->dev, vblk->disk, virtblk_attr_groups);
+	virtblk_debugfs_register(vblk);
 	return 0;
 
 out_free_tags:
@@ -925,6 +1041,7 @@ static void virtblk_remove(struct virtio_device *vdev)
 	/* Make sure no work handler is accessing the device. */
 	flush_work(&vblk->config_work);
 
+	virtblk_debugfs_unregister(vblk);
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 
@@ -329,6 +329,8 @@ static int blkdev_iopoll(struct kiocb *kiocb, bool wait)
 	struct block_device *bdev = I_BDEV(kiocb->ki_filp->f_mapping->host);
 	struct request_queue *q = bdev_get_queue(bdev);
 
+	if (kiocb->ki_flags & IOCB_POLL_HYBRID)
+		return blk_poll_hybrid(q, READ_ONCE(kiocb->ki_cookie), wait);
 	return blk_poll(q, READ_ONCE(kiocb->ki_cookie), wait);
 }
 
@@ -501,6 +503,92 @@ __blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter, int nr_pages)
 	return ret;
 }
 
+static void blkdev_bio_end_io_async(struct bio *bio)
+{
+	struct blkdev_dio *dio = container_of(bio, struct blkdev_dio, bio);
+	struct kiocb *iocb = dio->iocb;
+	ssize_t ret;
+
+	if (likely(!bio->bi_status)) {
+		ret = dio->size;
+		iocb->ki_pos += ret;
+	} else {
+		ret = blk_status_to_errno(bio->bi_status);
+	}
+
+	iocb->ki_complete(iocb, ret, 0);
+
+	if (dio->should_dirty) {
+		bio_check_pages_dirty(bio);
+	} else {
+		bio_release_pages(bio, false);
+		bio_put(bio);
+	}
+}
+
+/*
+ * Async I/O that fits in a single bio: no reference counting between bios,
+ * no plugging, and the dio is completed straight from the bio end_io.
+ */
+static ssize_t
+__blkdev_direct_IO_async(struct kiocb *iocb, struct iov_iter *iter,
+		int nr_pages)
+{
+	struct block_device *bdev = I_BDEV(bdev_file_inode(iocb->ki_filp));
+	bool is_read = iov_iter_rw(iter) == READ;
+	loff_t pos = iocb->ki_pos;
+	struct blkdev_dio *dio;
+	struct bio *bio;
+	blk_qc_t qc;
+	int ret;
+
+	if ((pos | iov_iter_alignment(iter)) &
+	    (bdev_logical_block_size(bdev) - 1))
+		return -EINVAL;
+
+	bio = bio_alloc_bioset(GFP_KERNEL, nr_pages, &blkdev_dio_pool);
+	dio = container_of(bio, struct blkdev_dio, bio);
+	dio->iocb = iocb;
+	dio->multi_bio = false;
+	dio->is_sync = false;
+	dio->should_dirty = false;
+
+	bio_set_dev(bio, bdev);
+	bio->bi_iter.bi_sector = pos >> 9;
+	bio->bi_write_hint = iocb->ki_hint;
+	bio->bi_end_io = blkdev_bio_end_io_async;
+	bio->bi_ioprio = iocb->ki_ioprio;
+
+	ret = bio_iov_iter_get_pages(bio, iter);
+	if (unlikely(ret)) {
+		bio_put(bio);
+		return ret;
+	}
+	dio->size = bio->bi_iter.bi_size;
+
+	if (is_read) {
+		bio->bi_opf = REQ_OP_READ;
+		if (iter_is_iovec(iter)) {
+			dio->should_dirty = true;
+			bio_set_pages_dirty(bio);
+		}
+	} else {
+		bio->bi_opf = dio_bio_write_op(iocb);
+		task_io_account_write(bio->bi_iter.bi_size);
+	}
+	if (iocb->ki_flags & IOCB_NOWAIT)
+		bio->bi_opf |= REQ_NOWAIT;
+
+	if (iocb->ki_flags & IOCB_HIPRI) {
+		bio_set_polled(bio, iocb);
+		qc = submit_bio(bio);
+		WRITE_ONCE(iocb->ki_cookie, qc);
+	} else {
+		submit_bio(bio);
+	}
+	return -EIOCBQUEUED;
+}
+
 static ssize_t
 blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
 {
@@ -509,15 +597,19 @@ blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
 	nr_pages = iov_iter_npages(iter, BIO_MAX_PAGES + 1);
 	if (!nr_pages)
 		return 0;
-	if (is_sync_kiocb(iocb) && nr_pages <= BIO_MAX_PAGES)
-		return __blkdev_direct_IO_simple(iocb, iter, nr_pages);
+	if (likely(nr_pages <= BIO_MAX_PAGES)) {
+		if (is_sync_kiocb(iocb))
+			return __blkdev_direct_IO_simple(iocb, iter, nr_pages);
+		return __blkdev_direct_IO_async(iocb, iter, nr_pages);
+	}
 
 	return __blkdev_direct_IO(iocb, iter, min(nr_pages, BIO_MAX_PAGES));
 }
 
 static __init int blkdev_init(void)
 {
-	return bioset_init(&blkdev_dio_pool, 4, offsetof(struct blkdev_dio, bio), BIOSET_NEED_BVECS);
+	return bioset_init(&blkdev_dio_pool, 4, offsetof(struct blkdev_dio, bio),
+			   BIOSET_NEED_BVECS | BIOSET_PERCPU_CACHE);
 }
 module_init(blkdev_init);
 
@@ -527,6 +619,7 @@ int __sync_blockdev(struct block_device *bdev, int wait)
 		return 0;
 	if (!wait)
 		return filemap_flush(bdev->bd_inode->i_mapping);
+	blkdev_drain_discards(bdev);
 	return filemap_write_and_wait(bdev->bd_inode->i_mapping);
 }
 
@@ -2059,7 +2152,7 @@ static long blkdev_fallocate(struct file *file, int mode, loff_t start,
 			break;
 
 		error = blkdev_issue_discard(bdev, start >> 9, len >> 9,
-					     GFP_KERNEL, 0);
+					     GFP_KERNEL, BLKDEV_DISCARD_ASYNC);
 		break;
 	default:
 		return -EOPNOTSUPP;
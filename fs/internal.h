@@ -79,6 +79,10 @@ long do_unlinkat(int dfd, struct filename *name);
 int may_linkat(struct path *link);
 int do_renameat2(int olddfd, struct filename *oldname, int newdfd,
 		 struct filename *newname, unsigned int flags);
+long do_mkdirat(int dfd, struct filename *name, umode_t mode);
+long do_symlinkat(struct filename *from, int newdfd, struct filename *to);
+int do_linkat(int olddfd, struct filename *old, int newdfd,
+	      struct filename *new, int flags);
 
 /*
  * namespace.c
@@ -194,6 +198,21 @@ extern const struct dentry_operations ns_dentry_operations;
 /* direct-io.c: */
 int sb_init_dio_done_wq(struct super_block *sb);
 
+/*
+ * readdir.c
+ */
+struct linux_dirent64;
+int vfs_getdents64(struct file *file, struct linux_dirent64 __user *dirent,
+		   unsigned int count);
+
+/*
+ * xattr.c
+ */
+ssize_t file_getxattr(struct file *f, const char __user *name,
+		      void __user *value, size_t size);
+int file_setxattr(struct file *f, const char __user *name,
+		  const void __user *value, size_t size, int flags);
+
 /*
  * fs/stat.c:
  */
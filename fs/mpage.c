@@ -30,6 +30,8 @@
 #include <linux/backing-dev.h>
 #include <linux/pagevec.h>
 #include <linux/cleancache.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "internal.h"
 
 /*
@@ -142,8 +144,17 @@ struct mpage_readpage_args {
 	struct buffer_head map_bh;
 	unsigned long first_logical_block;
 	get_block_t *get_block;
+	unsigned int nr_bios;
+	unsigned int nr_fast;
 };
 
+static struct bio *mpage_read_submit(struct mpage_readpage_args *args,
+				     int op_flags)
+{
+	args->nr_bios++;
+	return mpage_bio_submit(REQ_OP_READ, op_flags, args->bio);
+}
+
 /*
  * This is the worker routine which does all the work of mapping the disk
  * blocks and constructs largest possible bios, submits them for IO if the
@@ -294,7 +305,7 @@ static struct bio *do_mpage_readpage(struct mpage_readpage_args *args)
 	 * This page will go to BIO.  Do we need to send this BIO off first?
 	 */
 	if (args->bio && (args->last_block_in_bio != blocks[0] - 1))
-		args->bio = mpage_bio_submit(REQ_OP_READ, op_flags, args->bio);
+		args->bio = mpage_read_submit(args, op_flags);
 
 alloc_new:
 	if (args->bio == NULL) {
@@ -313,7 +324,7 @@ static struct bio *do_mpage_readpage(struct mpage_readpage_args *args)
 
 	length = first_hole << blkbits;
 	if (bio_add_page(args->bio, page, length, 0) < length) {
-		args->bio = mpage_bio_submit(REQ_OP_READ, op_flags, args->bio);
+		args->bio = mpage_read_submit(args, op_flags);
 		goto alloc_new;
 	}
 
@@ -321,7 +332,7 @@ static struct bio *do_mpage_readpage(struct mpage_readpage_args *args)
 	nblocks = map_bh->b_size >> blkbits;
 	if ((buffer_boundary(map_bh) && relative_block == nblocks) ||
 	    (first_hole != blocks_per_page))
-		args->bio = mpage_bio_submit(REQ_OP_READ, op_flags, args->bio);
+		args->bio = mpage_read_submit(args, op_flags);
 	else
 		args->last_block_in_bio = blocks[blocks_per_page - 1];
 out:
@@ -329,7 +340,7 @@ static struct bio *do_mpage_readpage(struct mpage_readpage_args *args)
 
 confused:
 	if (args->bio)
-		args->bio = mpage_bio_submit(REQ_OP_READ, op_flags, args->bio);
+		args->bio = mpage_read_submit(args, op_flags);
 	if (!PageUptodate(page))
 		block_read_full_page(page, args->get_block);
 	else
@@ -337,6 +348,127 @@ static struct bio *do_mpage_readpage(struct mpage_readpage_args *args)
 	goto out;
 }
 
+/*
+ * Readahead fast path: if @args->page lies entirely inside the extent cached
+ * in map_bh by an earlier get_block() call, and that extent continues the
+ * bio being built, the page can be appended without redoing the per-block
+ * mapping work of do_mpage_readpage().  Returns false if the page has to go
+ * through the slow path.
+ */
+static bool mpage_readahead_extend(struct mpage_readpage_args *args)
+{
+	struct page *page = args->page;
+	struct inode *inode = page->mapping->host;
+	const unsigned blkbits = inode->i_blkbits;
+	const unsigned blocks_per_page = PAGE_SIZE >> blkbits;
+	struct buffer_head *map_bh = &args->map_bh;
+	sector_t block_in_file, extent_end, first_block;
+
+	if (!args->bio || !buffer_mapped(map_bh) || buffer_uptodate(map_bh))
+		return false;
+	if (page_has_buffers(page) || cleancache_fs_enabled(page))
+		return false;
+
+	block_in_file = (sector_t)page->index << (PAGE_SHIFT - blkbits);
+	extent_end = args->first_logical_block + (map_bh->b_size >> blkbits);
+	if (block_in_file <= args->first_logical_block ||
+	    block_in_file + blocks_per_page > extent_end)
+		return false;
+
+	/* Pages straddling EOF need their tail zeroed, leave them alone. */
+	if (((loff_t)page->index + 1) << PAGE_SHIFT > i_size_read(inode))
+		return false;
+
+	first_block = map_bh->b_blocknr + (block_in_file -
+					   args->first_logical_block);
+	if (first_block != args->last_block_in_bio + 1)
+		return false;
+
+	if (bio_add_page(args->bio, page, PAGE_SIZE, 0) < PAGE_SIZE)
+		return false;
+
+	SetPageMappedToDisk(page);
+	args->last_block_in_bio = first_block + blocks_per_page - 1;
+	args->nr_fast++;
+
+	if (block_in_file + blocks_per_page == extent_end) {
+		clear_buffer_mapped(map_bh);
+		if (buffer_boundary(map_bh))
+			args->bio = mpage_read_submit(args, REQ_RAHEAD);
+	}
+	return true;
+}
+
+#ifdef CONFIG_DEBUG_FS
+/* Histogram of mpage bios per readahead window, log2 buckets. */
+#define MPAGE_RA_HIST_BUCKETS	8
+
+struct mpage_ra_stats {
+	unsigned long windows;
+	unsigned long pages;
+	unsigned long fast_pages;
+	unsigned long bios;
+	unsigned long hist[MPAGE_RA_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct mpage_ra_stats, mpage_ra_stats);
+
+static void mpage_ra_account(unsigned int nr_pages,
+			     struct mpage_readpage_args *args)
+{
+	struct mpage_ra_stats *stats = get_cpu_ptr(&mpage_ra_stats);
+
+	stats->windows++;
+	stats->pages += nr_pages;
+	stats->fast_pages += args->nr_fast;
+	stats->bios += args->nr_bios;
+	stats->hist[min_t(unsigned int, fls(args->nr_bios),
+			  MPAGE_RA_HIST_BUCKETS - 1)]++;
+	put_cpu_ptr(&mpage_ra_stats);
+}
+
+static int mpage_ra_stats_show(struct seq_file *m, void *v)
+{
+	struct mpage_ra_stats sum = { };
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct mpage_ra_stats *stats = per_cpu_ptr(&mpage_ra_stats, cpu);
+
+		sum.windows += READ_ONCE(stats->windows);
+		sum.pages += READ_ONCE(stats->pages);
+		sum.fast_pages += READ_ONCE(stats->fast_pages);
+		sum.bios += READ_ONCE(stats->bios);
+		for (i = 0; i < MPAGE_RA_HIST_BUCKETS; i++)
+			sum.hist[i] += READ_ONCE(stats->hist[i]);
+	}
+
+	seq_printf(m, "windows %lu\npages %lu\nfast_pages %lu\nbios %lu\n",
+		   sum.windows, sum.pages, sum.fast_pages, sum.bios);
+	seq_printf(m, "bios_per_window 0: %lu\n", sum.hist[0]);
+	for (i = 1; i < MPAGE_RA_HIST_BUCKETS - 1; i++)
+		seq_printf(m, "bios_per_window %u-%u: %lu\n", 1U << (i - 1),
+			   (1U << i) - 1, sum.hist[i]);
+	seq_printf(m, "bios_per_window %u+: %lu\n",
+		   1U << (MPAGE_RA_HIST_BUCKETS - 2), sum.hist[i]);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mpage_ra_stats);
+
+static int __init mpage_debugfs_init(void)
+{
+	debugfs_create_file("mpage_readahead", 0400, NULL, NULL,
+			    &mpage_ra_stats_fops);
+	return 0;
+}
+late_initcall(mpage_debugfs_init);
+#else
+static inline void mpage_ra_account(unsigned int nr_pages,
+				    struct mpage_readpage_args *args)
+{
+}
+#endif
+
 /**
  * mpage_readahead - start reads against pages
  * @rac: Describes which pages to read.
@@ -375,6 +507,10 @@ static struct bio *do_mpage_readpage(struct mpage_readpage_args *args)
  * this one.  So you should push what I/O you have currently accumulated.
  *
  * This all causes the disk requests to be issued in the correct order.
+ *
+ * Once get_block() has mapped a multi-block extent, the following pages that
+ * fall entirely inside it are appended to the current BIO directly, so a
+ * contiguous file is read with one get_block() call and one BIO per extent.
  */
 void mpage_readahead(struct readahead_control *rac, get_block_t get_block)
 {
@@ -383,16 +519,19 @@ void mpage_readahead(struct readahead_control *rac, get_block_t get_block)
 		.get_block = get_block,
 		.is_readahead = true,
 	};
+	unsigned int nr_pages = readahead_count(rac);
 
 	while ((page = readahead_page(rac))) {
 		prefetchw(&page->flags);
 		args.page = page;
 		args.nr_pages = readahead_count(rac);
-		args.bio = do_mpage_readpage(&args);
+		if (!mpage_readahead_extend(&args))
+			args.bio = do_mpage_readpage(&args);
 		put_page(page);
 	}
 	if (args.bio)
-		mpage_bio_submit(REQ_OP_READ, REQ_RAHEAD, args.bio);
+		mpage_read_submit(&args, REQ_RAHEAD);
+	mpage_ra_account(nr_pages, &args);
 }
 EXPORT_SYMBOL(mpage_readahead);
 
@@ -25,6 +25,8 @@
 
 #include <linux/uaccess.h>
 
+#include "internal.h"
+
 static const char *
 strcmp_prefix(const char *a, const char *a_prefix)
 {
@@ -589,6 +591,20 @@ SYSCALL_DEFINE5(lsetxattr, const char __user *, pathname,
 	return path_setxattr(pathname, name, value, size, flags, 0);
 }
 
+int file_setxattr(struct file *f, const char __user *name,
+		  const void __user *value, size_t size, int flags)
+{
+	int error;
+
+	audit_file(f);
+	error = mnt_want_write_file(f);
+	if (!error) {
+		error = setxattr(f->f_path.dentry, name, value, size, flags);
+		mnt_drop_write_file(f);
+	}
+	return error;
+}
+
 SYSCALL_DEFINE5(fsetxattr, int, fd, const char __user *, name,
 		const void __user *,value, size_t, size, int, flags)
 {
@@ -597,12 +613,7 @@ SYSCALL_DEFINE5(fsetxattr, int, fd, const char __user *, name,
 
 	if (!f.file)
 		return error;
-	audit_file(f.file);
-	error = mnt_want_write_file(f.file);
-	if (!error) {
-		error = setxattr(f.file->f_path.dentry, name, value, size, flags);
-		mnt_drop_write_file(f.file);
-	}
+	error = file_setxattr(f.file, name, value, size, flags);
 	fdput(f);
 	return error;
 }
@@ -681,6 +692,13 @@ SYSCALL_DEFINE4(lgetxattr, const char __user *, pathname,
 	return path_getxattr(pathname, name, value, size, 0);
 }
 
+ssize_t file_getxattr(struct file *f, const char __user *name,
+		      void __user *value, size_t size)
+{
+	audit_file(f);
+	return getxattr(f->f_path.dentry, name, value, size);
+}
+
 SYSCALL_DEFINE4(fgetxattr, int, fd, const char __user *, name,
 		void __user *, value, size_t, size)
 {
@@ -689,8 +707,7 @@ SYSCALL_DEFINE4(fgetxattr, int, fd, const char __user *, name,
 
 	if (!f.file)
 		return error;
-	audit_file(f.file);
-	error = getxattr(f.file->f_path.dentry, name, value, size);
+	error = file_getxattr(f.file, name, value, size);
 	fdput(f);
 	return error;
 }
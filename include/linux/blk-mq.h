@@ -157,6 +157,16 @@ struct blk_mq_hw_ctx {
 	unsigned long		poll_invoked;
 	/** @poll_success: Count how many polled requests were completed. */
 	unsigned long		poll_success;
+	/** @poll_sleeps: Count times hybrid polling slept before polling. */
+	unsigned long		poll_sleeps;
+	/** @poll_sleep_nsec: Length of the last hybrid polling sleep. */
+	unsigned long		poll_sleep_nsec;
+
+	/**
+	 * @lat_hist: Per-cpu completion latency histograms, allocated the
+	 * first time histograms are enabled on the queue.
+	 */
+	struct blk_stat_hist __percpu *lat_hist;
 
 #ifdef CONFIG_BLK_DEBUG_FS
 	/**
@@ -497,6 +507,50 @@ void blk_mq_start_request(struct request *rq);
 void blk_mq_end_request(struct request *rq, blk_status_t error);
 void __blk_mq_end_request(struct request *rq, blk_status_t error);
 
+/**
+ * struct io_comp_batch - requests completed together by a driver
+ * @req_list: Successfully completed requests, linked through ->queuelist.
+ * @need_ts: At least one request needs a completion timestamp.
+ * @complete: Driver callback that ends the requests, usually ending with
+ *	blk_mq_end_request_batch().
+ */
+struct io_comp_batch {
+	struct list_head req_list;
+	bool need_ts;
+	void (*complete)(struct io_comp_batch *);
+};
+
+#define DEFINE_IO_COMP_BATCH(name)					\
+	struct io_comp_batch name = {					\
+		.req_list = LIST_HEAD_INIT(name.req_list),		\
+	}
+
+void blk_mq_end_request_batch(struct io_comp_batch *iob);
+
+/*
+ * Add @req to @iob instead of completing it individually. Returns false if
+ * the request can't be batched, in which case the driver must complete it
+ * the normal way. Requests with an error, a scheduler or a custom end_io
+ * handler are never batched.
+ */
+static inline bool blk_mq_add_to_batch(struct request *req,
+				       struct io_comp_batch *iob,
+				       blk_status_t status,
+				       void (*complete)(struct io_comp_batch *))
+{
+	if (!iob || req->q->elevator || req->end_io || status != BLK_STS_OK)
+		return false;
+	if (!iob->complete)
+		iob->complete = complete;
+	else if (iob->complete != complete)
+		return false;
+	if (req->rq_flags & (RQF_IO_STAT | RQF_STATS))
+		iob->need_ts = true;
+	WRITE_ONCE(req->state, MQ_RQ_COMPLETE);
+	list_add_tail(&req->queuelist, &iob->req_list);
+	return true;
+}
+
 void blk_mq_requeue_request(struct request *rq, bool kick_requeue_list);
 void blk_mq_kick_requeue_list(struct request_queue *q);
 void blk_mq_delay_kick_requeue_list(struct request_queue *q, unsigned long msecs);
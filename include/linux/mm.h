@@ -820,6 +820,10 @@ static inline int page_mapcount(struct page *page)
 	return atomic_read(&page->_mapcount) + 1;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+int total_mapcount(struct page *page);
+int page_trans_huge_mapcount(struct page *page, int *total_mapcount);
+#else
 static inline int total_mapcount(struct page *page)
 {
 	return page_mapcount(page);
@@ -832,6 +836,7 @@ static inline int page_trans_huge_mapcount(struct page *page,
 		*total_mapcount = mapcount;
 	return mapcount;
 }
+#endif
 
 static inline struct page *virt_to_head_page(const void *x)
 {
@@ -859,6 +864,9 @@ enum compound_dtor_id {
 	COMPOUND_PAGE_DTOR,
 #ifdef CONFIG_HUGETLB_PAGE
 	HUGETLB_PAGE_DTOR,
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	TRANSHUGE_PAGE_DTOR,
 #endif
 	NR_COMPOUND_DTORS,
 };
@@ -2185,11 +2193,17 @@ static inline spinlock_t *pmd_lockptr(struct mm_struct *mm, pmd_t *pmd)
 
 static inline bool pmd_ptlock_init(struct page *page)
 {
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	page->pmd_huge_pte = NULL;
+#endif
 	return ptlock_init(page);
 }
 
 static inline void pmd_ptlock_free(struct page *page)
 {
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	VM_BUG_ON_PAGE(page->pmd_huge_pte, page);
+#endif
 	ptlock_free(page);
 }
 
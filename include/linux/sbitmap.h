@@ -398,6 +398,23 @@ void sbitmap_queue_resize(struct sbitmap_queue *sbq, unsigned int depth);
  */
 int __sbitmap_queue_get(struct sbitmap_queue *sbq);
 
+/**
+ * __sbitmap_queue_get_batch() - Try to allocate a batch of free bits from a
+ * &struct sbitmap_queue.
+ * @sbq: Bitmap queue to allocate from.
+ * @nr_tags: Number of bits to try to allocate, less than BITS_PER_LONG.
+ * @offset: Output parameter; bit number corresponding to bit 0 of the
+ *          returned mask.
+ *
+ * All bits are taken from a single word. Fewer than @nr_tags may be
+ * returned if some of them got allocated concurrently. Not supported for
+ * round robin allocation.
+ *
+ * Return: Mask of allocated bits relative to @offset, 0 on failure.
+ */
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset);
+
 /**
  * __sbitmap_queue_get_shallow() - Try to allocate a free bit from a &struct
  * sbitmap_queue, limiting the depth used from each word, with preemption
@@ -477,6 +494,17 @@ static inline int sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 void sbitmap_queue_min_shallow_depth(struct sbitmap_queue *sbq,
 				     unsigned int min_shallow_depth);
 
+/**
+ * sbitmap_queue_clear_batch() - Free a batch of allocated bits and wake up
+ * waiters on a &struct sbitmap_queue.
+ * @sbq: Bitmap to free from.
+ * @offset: Offset to subtract from each of @tags to get the bit number.
+ * @tags: Array of allocated bits.
+ * @nr_tags: Number of entries in @tags.
+ */
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+			       int *tags, int nr_tags);
+
 /**
  * sbitmap_queue_clear() - Free an allocated bit and wake up waiters on a
  * &struct sbitmap_queue.
@@ -476,6 +476,7 @@ struct ubuf_info {
 		};
 	};
 	refcount_t refcnt;
+	u8 flags;
 
 	struct mmpin {
 		struct user_struct *user;
@@ -483,6 +484,12 @@ struct ubuf_info {
 	} mmp;
 };
 
+/* ubuf_info::flags */
+enum {
+	/* The uarg owner keeps the pages valid until its callback runs */
+	SKBFL_DONT_ORPHAN = BIT(0),
+};
+
 #define skb_uarg(SKB)	((struct ubuf_info *)(skb_shinfo(SKB)->destructor_arg))
 
 int mm_account_pinned_pages(struct mmpin *mmp, size_t size);
@@ -2787,7 +2794,8 @@ static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
 	if (likely(!skb_zcopy(skb)))
 		return 0;
 	if (!skb_zcopy_is_nouarg(skb) &&
-	    skb_uarg(skb)->callback == sock_zerocopy_callback)
+	    (skb_uarg(skb)->callback == sock_zerocopy_callback ||
+	     skb_uarg(skb)->flags & SKBFL_DONT_ORPHAN))
 		return 0;
 	return skb_copy_ubufs(skb, gfp_mask);
 }
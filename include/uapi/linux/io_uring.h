@@ -45,6 +45,7 @@ struct io_uring_sqe {
 		__u32		rename_flags;
 		__u32		unlink_flags;
 		__u32		hardlink_flags;
+		__u32		xattr_flags;
 	};
 	__u64	user_data;	/* data to be passed back at completion time */
 	/* pack this to avoid bogus arm OABI complaints */
@@ -98,6 +99,25 @@ enum {
 #define IORING_SETUP_CLAMP	(1U << 4)	/* clamp SQ/CQ ring sizes */
 #define IORING_SETUP_ATTACH_WQ	(1U << 5)	/* attach to existing wq */
 #define IORING_SETUP_R_DISABLED	(1U << 6)	/* start with ring disabled */
+/*
+ * Don't interrupt the task to run completion task_work, batch it up and post
+ * it when the task next enters or leaves the kernel, e.g. on io_uring_enter()
+ * with IORING_ENTER_GETEVENTS. Only the task that created the ring, or enabled
+ * it with IORING_SETUP_R_DISABLED, may enter it; others get -EEXIST. Not
+ * compatible with IORING_SETUP_SQPOLL.
+ */
+#define IORING_SETUP_DEFER_TASKRUN	(1U << 13)
+/*
+ * Application provides the memory for the rings and SQEs, at
+ * cq_off.user_addr and sq_off.user_addr. Each must be physically
+ * contiguous, i.e. fit in a single (huge) page.
+ */
+#define IORING_SETUP_NO_MMAP		(1U << 14)
+/*
+ * With IORING_SETUP_IOPOLL, sleep for an estimate of the device's completion
+ * time before starting to spin, rather than spinning from the start.
+ */
+#define IORING_SETUP_HYBRID_IOPOLL	(1U << 17)
 
 enum {
 	IORING_OP_NOP,
@@ -137,6 +157,19 @@ enum {
 	IORING_OP_SHUTDOWN,
 	IORING_OP_RENAMEAT,
 	IORING_OP_UNLINKAT,
+	IORING_OP_MKDIRAT,
+	IORING_OP_SYMLINKAT,
+	IORING_OP_LINKAT,
+
+	IORING_OP_SEND_ZC		= 47,
+
+	/*
+	 * Not upstream, numbered past the upstream range so they can't clash
+	 * with opcodes added there.
+	 */
+	IORING_OP_GETDENTS		= 64,
+	IORING_OP_FGETXATTR,
+	IORING_OP_FSETXATTR,
 
 	/* this goes last, obviously */
 	IORING_OP_LAST,
@@ -178,6 +211,29 @@ enum {
 #define IORING_POLL_UPDATE_EVENTS	(1U << 1)
 #define IORING_POLL_UPDATE_USER_DATA	(1U << 2)
 
+/*
+ * accept flags stored in sqe->ioprio
+ *
+ * IORING_ACCEPT_MULTISHOT	Stay armed on the listening socket and post
+ *				a CQE with IORING_CQE_F_MORE for every
+ *				accepted connection.
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+
+/*
+ * send/recv flags stored in sqe->ioprio
+ *
+ * IORING_RECV_MULTISHOT	Multishot recv. Requires IOSQE_BUFFER_SELECT
+ *				and sqe->len == 0. Posts a CQE with
+ *				IORING_CQE_F_MORE for every provided buffer
+ *				filled, until an error or EOF is hit.
+ *
+ * IORING_RECVSEND_FIXED_BUF	Use a registered buffer, its index is passed
+ *				in sqe->buf_index. IORING_OP_SEND_ZC only.
+ */
+#define IORING_RECV_MULTISHOT		(1U << 1)
+#define IORING_RECVSEND_FIXED_BUF	(1U << 2)
+
 /*
  * IO completion data structure (Completion Queue Entry)
  */
@@ -192,9 +248,12 @@ struct io_uring_cqe {
  *
  * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
  * IORING_CQE_F_MORE	If set, parent SQE will generate more CQE entries
+ * IORING_CQE_F_NOTIF	Set for IORING_OP_SEND_ZC notifications, posted
+ *			once the stack no longer references the data
  */
 #define IORING_CQE_F_BUFFER		(1U << 0)
 #define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 3)
 
 enum {
 	IORING_CQE_BUFFER_SHIFT		= 16,
@@ -219,7 +278,7 @@ struct io_sqring_offsets {
 	__u32 dropped;
 	__u32 array;
 	__u32 resv1;
-	__u64 resv2;
+	__u64 user_addr;
 };
 
 /*
@@ -237,7 +296,7 @@ struct io_cqring_offsets {
 	__u32 cqes;
 	__u32 flags;
 	__u32 resv1;
-	__u64 resv2;
+	__u64 user_addr;
 };
 
 /*
@@ -254,6 +313,7 @@ struct io_cqring_offsets {
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
 #define IORING_ENTER_SQ_WAIT	(1U << 2)
 #define IORING_ENTER_EXT_ARG	(1U << 3)
+#define IORING_ENTER_REGISTERED_RING	(1U << 4)
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -317,6 +377,32 @@ enum {
 	/* set/get max number of io-wq workers */
 	IORING_REGISTER_IOWQ_MAX_WORKERS	= 19,
 
+	/* register/unregister io_uring fds with the ring */
+	IORING_REGISTER_RING_FDS		= 20,
+	IORING_UNREGISTER_RING_FDS		= 21,
+
+	/* register/unregister a ring of provided buffers */
+	IORING_REGISTER_PBUF_RING		= 22,
+	IORING_UNREGISTER_PBUF_RING		= 23,
+
+	/*
+	 * Not upstream, numbered past the upstream range so they can't clash
+	 * with opcodes added there.
+	 */
+
+	/* set/get per-ring SQPOLL submit quota and idle time */
+	IORING_REGISTER_SQPOLL_QUOTA		= 64,
+
+	/*
+	 * set/get io-wq worker idle timeout, in msecs. io-wq is per task, so
+	 * this is task wide: it applies to the workers of every task using
+	 * the ring, and thus to all other rings of those tasks too
+	 */
+	IORING_REGISTER_IOWQ_IDLE_TIMEOUT	= 65,
+
+	/* resize CQ ring, IORING_SETUP_NO_MMAP rings only */
+	IORING_REGISTER_RESIZE_CQ		= 66,
+
 	/* this goes last */
 	IORING_REGISTER_LAST
 };
@@ -357,6 +443,38 @@ struct io_uring_rsrc_update2 {
 	__u32 resv2;
 };
 
+struct io_uring_buf {
+	__u64	addr;
+	__u32	len;
+	__u16	bid;
+	__u16	resv;
+};
+
+struct io_uring_buf_ring {
+	union {
+		/*
+		 * To avoid spilling into more pages than we need to, the
+		 * ring tail is overlaid with the io_uring_buf->resv field.
+		 */
+		struct {
+			__u64	resv1;
+			__u32	resv2;
+			__u16	resv3;
+			__u16	tail;
+		};
+		struct io_uring_buf	bufs[0];
+	};
+};
+
+/* argument for IORING_(UN)REGISTER_PBUF_RING */
+struct io_uring_buf_reg {
+	__u64	ring_addr;
+	__u32	ring_entries;
+	__u16	bgid;
+	__u16	pad;
+	__u64	resv[3];
+};
+
 /* Skip updating fd indexes set to this value in the fd table */
 #define IORING_REGISTER_FILES_SKIP	(-2)
 
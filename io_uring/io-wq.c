@@ -122,6 +122,9 @@ struct io_wq {
 
 	struct task_struct *task;
 
+	/* idle workers beyond the first of an acct exit after this long */
+	unsigned long idle_timeout;
+
 	struct io_wqe *wqes[];
 };
 
@@ -652,7 +655,7 @@ static int io_wqe_worker(void *data)
 		raw_spin_unlock(&wqe->lock);
 		if (io_flush_signals())
 			continue;
-		ret = schedule_timeout(WORKER_IDLE_TIMEOUT);
+		ret = schedule_timeout(READ_ONCE(wq->idle_timeout));
 		if (signal_pending(current)) {
 			struct ksignal ksig;
 
@@ -1186,6 +1189,7 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 	}
 
 	wq->task = get_task_struct(data->task);
+	wq->idle_timeout = WORKER_IDLE_TIMEOUT;
 	atomic_set(&wq->worker_refs, 1);
 	init_completion(&wq->worker_done);
 	return wq;
@@ -1400,6 +1404,36 @@ int io_wq_max_workers(struct io_wq *wq, int *new_count)
 	return 0;
 }
 
+static bool io_wq_worker_rearm_idle(struct io_worker *worker, void *data)
+{
+	if (worker->flags & IO_WORKER_F_FREE)
+		wake_up_process(worker->task);
+	return false;
+}
+
+/*
+ * Set how long idle workers linger before exiting, returns old value in
+ * msecs. If *msecs is 0, then just return the old value. Workers already
+ * idle are woken up so they go back to sleep with the new timeout.
+ */
+int io_wq_idle_timeout(struct io_wq *wq, unsigned int *msecs)
+{
+	unsigned int prev = jiffies_to_msecs(READ_ONCE(wq->idle_timeout));
+	int node;
+
+	if (*msecs) {
+		WRITE_ONCE(wq->idle_timeout, msecs_to_jiffies(*msecs) ?: 1);
+
+		rcu_read_lock();
+		for_each_node(node)
+			io_wq_for_each_worker(wq->wqes[node],
+					      io_wq_worker_rearm_idle, NULL);
+		rcu_read_unlock();
+	}
+	*msecs = prev;
+	return 0;
+}
+
 static __init int io_wq_init(void)
 {
 	int ret;
@@ -197,8 +197,25 @@ struct io_rings {
 enum io_uring_cmd_flags {
 	IO_URING_F_NONBLOCK		= 1,
 	IO_URING_F_COMPLETE_DEFER	= 2,
+	/* issued from the poll handler of an armed multishot request */
+	IO_URING_F_MULTISHOT		= 4,
 };
 
+/*
+ * Returned by a multishot issue once the request is done, the final result
+ * and cflags are in ->result and ->compl.cflags, see io_req_stop_multishot()
+ */
+#define IOU_STOP_MULTISHOT		1
+/*
+ * Returned by a multishot issue that gave up after MULTISHOT_MAX_RETRY
+ * rounds while more data may be pending, the poll handler requeues it
+ * through task_work so other requests get to run in between.
+ */
+#define IOU_REQUEUE			2
+
+/* max CQEs a multishot request posts per issue before yielding */
+#define MULTISHOT_MAX_RETRY		32
+
 struct io_mapped_ubuf {
 	u64		ubuf;
 	u64		ubuf_end;
@@ -262,6 +279,40 @@ struct io_buffer {
 	__u16 bid;
 };
 
+#define IO_BUFFER_LIST_BUF_PER_PAGE (PAGE_SIZE / sizeof(struct io_uring_buf))
+
+/*
+ * A group of provided buffers that lives in memory shared with the
+ * application. Userspace adds buffers by filling in ring entries and
+ * bumping ->tail, the kernel consumes them by advancing ->head under
+ * ->uring_lock. No SQE or syscall is needed to recycle a buffer.
+ */
+struct io_buffer_list {
+	struct io_uring_buf_ring *buf_ring;
+	struct page **buf_pages;
+	__u16 bgid;
+	__u16 buf_nr_pages;
+	__u16 nr_entries;
+	__u16 head;
+	__u16 mask;
+};
+
+/*
+ * Zerocopy send notifier. The network stack holds a reference for each skb
+ * pointing at the sent pages and the request holds one until it has posted
+ * its result; the IORING_CQE_F_NOTIF CQE is posted when the last one goes.
+ */
+struct io_notif {
+	struct ubuf_info	uarg;
+	struct io_ring_ctx	*ctx;
+	u64			user_data;
+	/* pages charged against RLIMIT_MEMLOCK while the data is in flight */
+	unsigned long		account_pages;
+	/* rsrc node pinned while a registered buffer is in flight */
+	struct percpu_ref	*rsrc_refs;
+	struct work_struct	work;
+};
+
 struct io_restriction {
 	DECLARE_BITMAP(register_op, IORING_REGISTER_LAST);
 	DECLARE_BITMAP(sqe_op, IORING_OP_LAST);
@@ -293,6 +344,11 @@ struct io_sq_data {
 
 	unsigned long		state;
 	struct completion	exited;
+
+	/* stats, only modified by the thread under ->lock */
+	u64			submitted;
+	u64			idle_spins;
+	u64			wakeups;
 };
 
 #define IO_COMPL_BATCH			32
@@ -359,6 +415,11 @@ struct io_ring_ctx {
 		 */
 		u32			*sq_array;
 		struct io_uring_sqe	*sq_sqes;
+		/* pinned application memory, IORING_SETUP_NO_MMAP only */
+		struct page		**ring_pages;
+		struct page		**sqe_pages;
+		unsigned int		n_ring_pages;
+		unsigned int		n_sqe_pages;
 		unsigned		cached_sq_head;
 		unsigned		sq_entries;
 		struct list_head	defer_list;
@@ -378,9 +439,12 @@ struct io_ring_ctx {
 		struct list_head	ltimeout_list;
 		struct list_head	cq_overflow_list;
 		struct xarray		io_buffers;
+		struct xarray		io_buf_lists;
 		struct xarray		personalities;
 		u32			pers_next;
 		unsigned		sq_thread_idle;
+		/* max SQEs per SQPOLL pass when sharing the thread, 0: default */
+		unsigned		sq_quota;
 	} ____cacheline_aligned_in_smp;
 
 	/* IRQ completion list, under ->completion_lock */
@@ -450,6 +514,12 @@ struct io_ring_ctx {
 		struct user_struct		*user;
 		struct mm_struct		*mm_account;
 
+		/*
+		 * IORING_SETUP_DEFER_TASKRUN: the only task allowed to enter
+		 * the ring, completions only run in its task_work
+		 */
+		struct task_struct		*submitter_task;
+
 		/* ctx exit and cancelation */
 		struct llist_head		fallback_llist;
 		struct delayed_work		fallback_work;
@@ -458,9 +528,14 @@ struct io_ring_ctx {
 		struct completion		ref_comp;
 		u32				iowq_limits[2];
 		bool				iowq_limits_set;
+		/* io-wq idle timeout in msecs, 0 if never set */
+		u32				iowq_idle_ms;
 	};
 };
 
+/* max number of ring fds a task can register, see io_ringfd_register() */
+#define IO_RINGFD_REG_MAX		16
+
 struct io_uring_task {
 	/* submission side */
 	int			cached_refs;
@@ -476,6 +551,13 @@ struct io_uring_task {
 	struct io_wq_work_list	task_list;
 	struct callback_head	task_work;
 	bool			task_running;
+	/* pending task_work was queued with TWA_RESUME */
+	bool			task_resume;
+	/* IORING_SETUP_DEFER_TASKRUN completions of the ctx being run */
+	struct io_wq_work_list	compl_list;
+
+	/* ring files usable with IORING_ENTER_REGISTERED_RING */
+	struct file		*registered_rings[IO_RINGFD_REG_MAX];
 };
 
 /*
@@ -582,6 +664,9 @@ struct io_sr_msg {
 	size_t				done_io;
 	struct io_buffer		*kbuf;
 	void __user			*msg_control;
+	/* IORING_OP_SEND_ZC */
+	unsigned short			flags;
+	struct io_notif			*notif;
 };
 
 struct io_open {
@@ -693,6 +778,20 @@ struct io_hardlink {
 	int				flags;
 };
 
+struct io_getdents {
+	struct file			*file;
+	struct linux_dirent64 __user	*dirent;
+	unsigned int			count;
+};
+
+struct io_xattr {
+	struct file			*file;
+	const char __user		*name;
+	void __user			*value;
+	size_t				size;
+	int				flags;
+};
+
 struct io_completion {
 	struct file			*file;
 	u32				cflags;
@@ -743,6 +842,8 @@ enum {
 	REQ_F_REFCOUNT_BIT,
 	REQ_F_ARM_LTIMEOUT_BIT,
 	REQ_F_PARTIAL_IO_BIT,
+	REQ_F_BUFFER_RING_BIT,
+	REQ_F_APOLL_MULTISHOT_BIT,
 	/* keep async read/write and isreg together and in order */
 	REQ_F_NOWAIT_READ_BIT,
 	REQ_F_NOWAIT_WRITE_BIT,
@@ -800,6 +901,10 @@ enum {
 	REQ_F_ARM_LTIMEOUT	= BIT(REQ_F_ARM_LTIMEOUT_BIT),
 	/* request has already done partial IO */
 	REQ_F_PARTIAL_IO	= BIT(REQ_F_PARTIAL_IO_BIT),
+	/* selected buffer comes from a provided buffer ring */
+	REQ_F_BUFFER_RING	= BIT(REQ_F_BUFFER_RING_BIT),
+	/* internal poll stays armed and reissues the request on each event */
+	REQ_F_APOLL_MULTISHOT	= BIT(REQ_F_APOLL_MULTISHOT_BIT),
 };
 
 struct async_poll {
@@ -856,6 +961,8 @@ struct io_kiocb {
 		struct io_mkdir		mkdir;
 		struct io_symlink	symlink;
 		struct io_hardlink	hardlink;
+		struct io_getdents	getdents;
+		struct io_xattr		xattr;
 		/* use only after cleaning per-op data, see io_clean_op() */
 		struct io_completion	compl;
 	};
@@ -1071,6 +1178,30 @@ static const struct io_op_def io_op_defs[] = {
 	},
 	[IORING_OP_RENAMEAT] = {},
 	[IORING_OP_UNLINKAT] = {},
+	[IORING_OP_MKDIRAT] = {},
+	[IORING_OP_SYMLINKAT] = {},
+	[IORING_OP_LINKAT] = {},
+	/* upstream opcodes this kernel doesn't implement */
+	[IORING_OP_LINKAT + 1 ... IORING_OP_SEND_ZC - 1] = {
+		.not_supported		= 1,
+	},
+	[IORING_OP_SEND_ZC] = {
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+		.pollout		= 1,
+	},
+	[IORING_OP_SEND_ZC + 1 ... IORING_OP_GETDENTS - 1] = {
+		.not_supported		= 1,
+	},
+	[IORING_OP_GETDENTS] = {
+		.needs_file		= 1,
+	},
+	[IORING_OP_FGETXATTR] = {
+		.needs_file		= 1,
+	},
+	[IORING_OP_FSETXATTR] = {
+		.needs_file		= 1,
+	},
 };
 
 /* requests with any of those set should undergo io_disarm_next() */
@@ -1097,11 +1228,15 @@ static struct file *io_file_get(struct io_ring_ctx *ctx,
 				struct io_kiocb *req, int fd, bool fixed,
 				unsigned int issue_flags);
 static void __io_queue_sqe(struct io_kiocb *req);
+static int io_issue_sqe(struct io_kiocb *req, unsigned int issue_flags);
 static void io_rsrc_put_work(struct work_struct *work);
 
 static void io_req_task_queue(struct io_kiocb *req);
+static void __io_poll_execute(struct io_kiocb *req, int mask);
 static void io_submit_flush_completions(struct io_ring_ctx *ctx);
 static int io_req_prep_async(struct io_kiocb *req);
+static int io_account_mem(struct io_ring_ctx *ctx, unsigned long nr_pages);
+static void io_unaccount_mem(struct io_ring_ctx *ctx, unsigned long nr_pages);
 
 static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
 				 unsigned int issue_flags, u32 slot_index);
@@ -1342,6 +1477,7 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 	INIT_LIST_HEAD(&ctx->cq_overflow_list);
 	init_completion(&ctx->ref_comp);
 	xa_init_flags(&ctx->io_buffers, XA_FLAGS_ALLOC1);
+	xa_init(&ctx->io_buf_lists);
 	xa_init_flags(&ctx->personalities, XA_FLAGS_ALLOC1);
 	mutex_init(&ctx->uring_lock);
 	init_waitqueue_head(&ctx->cq_wait);
@@ -1592,11 +1728,20 @@ static inline void io_commit_cqring(struct io_ring_ctx *ctx)
 	__io_commit_cqring(ctx);
 }
 
+/*
+ * Lockless readers of ctx->rings hold rcu_read_lock(), IORING_REGISTER_RESIZE_CQ
+ * can swap the rings under them.
+ */
 static inline bool io_sqring_full(struct io_ring_ctx *ctx)
 {
-	struct io_rings *r = ctx->rings;
+	struct io_rings *r;
+	bool full;
 
-	return READ_ONCE(r->sq.tail) - ctx->cached_sq_head == ctx->sq_entries;
+	rcu_read_lock();
+	r = READ_ONCE(ctx->rings);
+	full = READ_ONCE(r->sq.tail) - ctx->cached_sq_head == ctx->sq_entries;
+	rcu_read_unlock();
+	return full;
 }
 
 static inline unsigned int __io_cqring_events(struct io_ring_ctx *ctx)
@@ -1623,9 +1768,14 @@ static inline struct io_uring_cqe *io_get_cqe(struct io_ring_ctx *ctx)
 
 static inline bool io_should_trigger_evfd(struct io_ring_ctx *ctx)
 {
+	unsigned int cq_flags;
+
 	if (likely(!ctx->cq_ev_fd))
 		return false;
-	if (READ_ONCE(ctx->rings->cq_flags) & IORING_CQ_EVENTFD_DISABLED)
+	rcu_read_lock();
+	cq_flags = READ_ONCE(READ_ONCE(ctx->rings)->cq_flags);
+	rcu_read_unlock();
+	if (cq_flags & IORING_CQ_EVENTFD_DISABLED)
 		return false;
 	return !ctx->eventfd_async || io_wq_current_is_worker();
 }
@@ -1839,6 +1989,42 @@ static noinline bool io_fill_cqe_aux(struct io_ring_ctx *ctx, u64 user_data,
 	return __io_fill_cqe(ctx, user_data, res, cflags);
 }
 
+static bool io_post_aux_cqe(struct io_ring_ctx *ctx, u64 user_data,
+			    s32 res, u32 cflags)
+{
+	bool filled;
+
+	spin_lock(&ctx->completion_lock);
+	filled = io_fill_cqe_aux(ctx, user_data, res, cflags);
+	io_commit_cqring(ctx);
+	spin_unlock(&ctx->completion_lock);
+	if (filled)
+		io_cqring_ev_posted(ctx);
+	return filled;
+}
+
+/*
+ * We're the last reference to this request, add to our locked free_list cache.
+ */
+static void __io_req_complete_put(struct io_kiocb *req)
+	__must_hold(&req->ctx->completion_lock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK)) {
+		if (req->flags & IO_DISARM_MASK)
+			io_disarm_next(req);
+		if (req->link) {
+			io_req_task_queue(req->link);
+			req->link = NULL;
+		}
+	}
+	io_dismantle_req(req);
+	io_put_task(req->task, 1);
+	list_add(&req->inflight_entry, &ctx->locked_free_list);
+	ctx->locked_free_nr++;
+}
+
 static void io_req_complete_post(struct io_kiocb *req, s32 res,
 				 u32 cflags)
 {
@@ -1846,23 +2032,8 @@ static void io_req_complete_post(struct io_kiocb *req, s32 res,
 
 	spin_lock(&ctx->completion_lock);
 	__io_fill_cqe(ctx, req->user_data, res, cflags);
-	/*
-	 * If we're the last reference to this request, add to our locked
-	 * free_list cache.
-	 */
 	if (req_ref_put_and_test(req)) {
-		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK)) {
-			if (req->flags & IO_DISARM_MASK)
-				io_disarm_next(req);
-			if (req->link) {
-				io_req_task_queue(req->link);
-				req->link = NULL;
-			}
-		}
-		io_dismantle_req(req);
-		io_put_task(req->task, 1);
-		list_add(&req->inflight_entry, &ctx->locked_free_list);
-		ctx->locked_free_nr++;
+		__io_req_complete_put(req);
 	} else {
 		if (!percpu_ref_tryget(&ctx->refs))
 			req = NULL;
@@ -1900,6 +2071,36 @@ static inline void __io_req_complete(struct io_kiocb *req, unsigned issue_flags,
 		io_req_complete_post(req, res, cflags);
 }
 
+/*
+ * Called by a multishot request issued from its poll handler when it has to
+ * terminate. The poll handler owns the request, it tears the poll down and
+ * posts the final CQE without IORING_CQE_F_MORE.
+ */
+static inline int io_req_stop_multishot(struct io_kiocb *req, s32 res,
+					u32 cflags)
+{
+	if (res < 0)
+		req_set_fail(req);
+	if (io_req_needs_clean(req))
+		io_clean_op(req);
+	req->result = res;
+	req->compl.cflags = cflags;
+	return IOU_STOP_MULTISHOT;
+}
+
+/*
+ * A multishot request looped MULTISHOT_MAX_RETRY times or the task needs to
+ * reschedule. From the poll handler have it requeued via task_work. On the
+ * first issue return -EAGAIN, poll gets armed and, with data still pending,
+ * queues the request through task_work right away.
+ */
+static int io_multishot_yield(struct io_kiocb *req, unsigned int issue_flags)
+{
+	if (issue_flags & IO_URING_F_MULTISHOT)
+		return IOU_REQUEUE;
+	return -EAGAIN;
+}
+
 static inline void io_req_complete(struct io_kiocb *req, s32 res)
 {
 	__io_req_complete(req, 0, res, 0);
@@ -2165,10 +2366,47 @@ static inline struct io_kiocb *io_req_find_next(struct io_kiocb *req)
 	return __io_req_find_next(req);
 }
 
+/*
+ * Post all completions task_work deferred for @ctx, see io_req_task_complete(),
+ * taking ->completion_lock and waking waiters once for the whole batch.
+ */
+static void io_flush_deferred_completions(struct io_ring_ctx *ctx,
+					  struct io_uring_task *tctx)
+{
+	struct io_wq_work_node *node = tctx->compl_list.first;
+	unsigned int nr_freed = 0;
+
+	INIT_WQ_LIST(&tctx->compl_list);
+
+	spin_lock(&ctx->completion_lock);
+	while (node) {
+		struct io_kiocb *req = container_of(node, struct io_kiocb,
+						    io_task_work.node);
+
+		node = node->next;
+		__io_fill_cqe(ctx, req->user_data, req->result,
+			      req->compl.cflags);
+		if (req_ref_put_and_test(req)) {
+			__io_req_complete_put(req);
+			nr_freed++;
+		}
+	}
+	io_commit_cqring(ctx);
+	spin_unlock(&ctx->completion_lock);
+	io_cqring_ev_posted(ctx);
+	/* each freed request held a ctx ref, see io_req_complete_post() */
+	if (nr_freed)
+		percpu_ref_put_many(&ctx->refs, nr_freed);
+}
+
 static void ctx_flush_and_put(struct io_ring_ctx *ctx, bool *locked)
 {
+	struct io_uring_task *tctx = current->io_uring;
+
 	if (!ctx)
 		return;
+	if (tctx->compl_list.first)
+		io_flush_deferred_completions(ctx, tctx);
 	if (*locked) {
 		if (ctx->submit_state.compl_nr)
 			io_submit_flush_completions(ctx);
@@ -2236,28 +2474,46 @@ static void io_req_task_work_add(struct io_kiocb *req)
 	enum task_work_notify_mode notify;
 	struct io_wq_work_node *node;
 	unsigned long flags;
-	bool running;
+	bool running, upgrade;
 
 	WARN_ON_ONCE(!tctx);
 
+	/*
+	 * SQPOLL kernel thread doesn't need notification, just a wakeup. For
+	 * all other cases, use TWA_SIGNAL unconditionally to ensure we're
+	 * processing task_work. There's no reliable way to tell if TWA_RESUME
+	 * will do the job, unless the ring asked for deferred task_work and
+	 * so promised to reap completions with io_uring_enter().
+	 */
+	if (req->ctx->flags & IORING_SETUP_SQPOLL)
+		notify = TWA_NONE;
+	else if (req->ctx->flags & IORING_SETUP_DEFER_TASKRUN)
+		notify = TWA_RESUME;
+	else
+		notify = TWA_SIGNAL;
+
 	spin_lock_irqsave(&tctx->task_lock, flags);
 	wq_list_add_tail(&req->io_task_work.node, &tctx->task_list);
 	running = tctx->task_running;
-	if (!running)
+	/*
+	 * The task_work is shared by all rings of the task. If a deferred ring
+	 * queued it, a normal ring joining the list still needs the signal.
+	 */
+	upgrade = running && tctx->task_resume && notify == TWA_SIGNAL;
+	if (!running) {
 		tctx->task_running = true;
+		tctx->task_resume = notify == TWA_RESUME;
+	} else if (upgrade) {
+		tctx->task_resume = false;
+	}
 	spin_unlock_irqrestore(&tctx->task_lock, flags);
 
+	if (upgrade)
+		set_notify_signal(tsk);
 	/* task_work already pending, we're done */
 	if (running)
 		return;
 
-	/*
-	 * SQPOLL kernel thread doesn't need notification, just a wakeup. For
-	 * all other cases, use TWA_SIGNAL unconditionally to ensure we're
-	 * processing task_work. There's no reliable way to tell if TWA_RESUME
-	 * will do the job.
-	 */
-	notify = (req->ctx->flags & IORING_SETUP_SQPOLL) ? TWA_NONE : TWA_SIGNAL;
 	if (!task_work_add(tsk, &tctx->task_work, notify)) {
 		wake_up_process(tsk);
 		return;
@@ -2441,9 +2697,14 @@ static inline void io_put_req_deferred(struct io_kiocb *req)
 
 static unsigned io_cqring_events(struct io_ring_ctx *ctx)
 {
+	unsigned int head;
+
 	/* See comment at the top of this file */
 	smp_rmb();
-	return __io_cqring_events(ctx);
+	rcu_read_lock();
+	head = READ_ONCE(READ_ONCE(ctx->rings)->cq.head);
+	rcu_read_unlock();
+	return ctx->cached_cq_tail - head;
 }
 
 static inline unsigned int io_sqring_entries(struct io_ring_ctx *ctx)
@@ -2458,6 +2719,14 @@ static unsigned int io_put_kbuf(struct io_kiocb *req, struct io_buffer *kbuf)
 {
 	unsigned int cflags;
 
+	/* ring buffers were consumed at selection time, bid is in buf_index */
+	if (req->flags & REQ_F_BUFFER_RING) {
+		cflags = req->buf_index << IORING_CQE_BUFFER_SHIFT;
+		cflags |= IORING_CQE_F_BUFFER;
+		req->flags &= ~(REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING);
+		return cflags;
+	}
+
 	cflags = kbuf->bid << IORING_CQE_BUFFER_SHIFT;
 	cflags |= IORING_CQE_F_BUFFER;
 	req->flags &= ~REQ_F_BUFFER_SELECTED;
@@ -2791,7 +3060,16 @@ static void io_req_task_complete(struct io_kiocb *req, bool *locked)
 	unsigned int cflags = io_put_rw_kbuf(req);
 	int res = req->result;
 
-	if (*locked) {
+	if ((req->ctx->flags & IORING_SETUP_DEFER_TASKRUN) &&
+	    req->task == current) {
+		/*
+		 * Collect on the submitter's list, tctx_task_work() posts it
+		 * in one batch before switching ctx or returning to userspace.
+		 */
+		io_req_complete_state(req, res, cflags);
+		wq_list_add_tail(&req->io_task_work.node,
+				 &current->io_uring->compl_list);
+	} else if (*locked) {
 		struct io_ring_ctx *ctx = req->ctx;
 		struct io_submit_state *state = &ctx->submit_state;
 
@@ -3000,6 +3278,8 @@ static int io_prep_rw(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 			return -EOPNOTSUPP;
 
 		kiocb->ki_flags |= IOCB_HIPRI;
+		if (ctx->flags & IORING_SETUP_HYBRID_IOPOLL)
+			kiocb->ki_flags |= IOCB_POLL_HYBRID;
 		kiocb->ki_complete = io_complete_rw_iopoll;
 		req->iopoll_completed = 0;
 	} else {
@@ -3110,11 +3390,11 @@ static void kiocb_done(struct kiocb *kiocb, ssize_t ret,
 	}
 }
 
-static int __io_import_fixed(struct io_kiocb *req, int rw, struct iov_iter *iter,
-			     struct io_mapped_ubuf *imu)
+static int __io_import_fixed(int rw, struct iov_iter *iter,
+			     struct io_mapped_ubuf *imu, u64 buf_addr,
+			     size_t len)
 {
-	size_t len = req->rw.len;
-	u64 buf_end, buf_addr = req->rw.addr;
+	u64 buf_end;
 	size_t offset;
 
 	if (unlikely(check_add_overflow(buf_addr, (u64)len, &buf_end)))
@@ -3172,7 +3452,7 @@ static int io_import_fixed(struct io_kiocb *req, int rw, struct iov_iter *iter)
 {
 	if (WARN_ON_ONCE(!req->imu))
 		return -EFAULT;
-	return __io_import_fixed(req, rw, iter, req->imu);
+	return __io_import_fixed(rw, iter, req->imu, req->rw.addr, req->rw.len);
 }
 
 static void io_ring_submit_unlock(struct io_ring_ctx *ctx, bool needs_lock)
@@ -3227,14 +3507,79 @@ static struct io_buffer *io_buffer_select(struct io_kiocb *req, size_t *len,
 	return kbuf;
 }
 
+static void __user *io_ring_buffer_select(struct io_kiocb *req, size_t *len,
+					  int bgid, bool needs_lock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_buffer_list *bl;
+	struct io_uring_buf *buf;
+	void __user *ret = NULL;
+	__u16 head;
+
+	/* don't bother with the lock if no ring was ever registered */
+	if (xa_empty(&ctx->io_buf_lists))
+		return NULL;
+
+	io_ring_submit_lock(ctx, needs_lock);
+
+	lockdep_assert_held(&ctx->uring_lock);
+
+	bl = xa_load(&ctx->io_buf_lists, bgid);
+	if (!bl)
+		goto out;
+
+	/* pairs with the tail store done by the application */
+	head = bl->head;
+	if (unlikely(smp_load_acquire(&bl->buf_ring->tail) == head)) {
+		ret = ERR_PTR(-ENOBUFS);
+		goto out;
+	}
+
+	head &= bl->mask;
+	if (head < IO_BUFFER_LIST_BUF_PER_PAGE) {
+		buf = &bl->buf_ring->bufs[head];
+	} else {
+		int off = head & (IO_BUFFER_LIST_BUF_PER_PAGE - 1);
+		int index = head / IO_BUFFER_LIST_BUF_PER_PAGE;
+
+		buf = page_address(bl->buf_pages[index]);
+		buf += off;
+	}
+	if (*len > READ_ONCE(buf->len))
+		*len = READ_ONCE(buf->len);
+	req->buf_index = READ_ONCE(buf->bid);
+	req->flags |= REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING;
+	ret = u64_to_user_ptr(READ_ONCE(buf->addr));
+	/* the entry belongs to this request until its CQE is posted */
+	bl->head++;
+out:
+	io_ring_submit_unlock(ctx, needs_lock);
+	return ret;
+}
+
 static void __user *io_rw_buffer_select(struct io_kiocb *req, size_t *len,
 					bool needs_lock)
 {
 	struct io_buffer *kbuf;
+	void __user *buf;
 	u16 bgid;
 
-	kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
+	if (req->flags & REQ_F_BUFFER_RING) {
+		*len = req->rw.len;
+		return u64_to_user_ptr(req->rw.addr);
+	}
+
 	bgid = req->buf_index;
+	buf = io_ring_buffer_select(req, len, bgid, needs_lock);
+	if (buf) {
+		if (!IS_ERR(buf)) {
+			req->rw.addr = (u64) (unsigned long) buf;
+			req->rw.len = *len;
+		}
+		return buf;
+	}
+
+	kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
 	kbuf = io_buffer_select(req, len, bgid, kbuf, needs_lock);
 	if (IS_ERR(kbuf))
 		return kbuf;
@@ -3267,6 +3612,11 @@ static ssize_t __io_iov_buffer_select(struct io_kiocb *req, struct iovec *iov,
 static ssize_t io_iov_buffer_select(struct io_kiocb *req, struct iovec *iov,
 				    bool needs_lock)
 {
+	if (req->flags & REQ_F_BUFFER_RING) {
+		iov[0].iov_base = u64_to_user_ptr(req->rw.addr);
+		iov[0].iov_len = req->rw.len;
+		return 0;
+	}
 	if (req->flags & REQ_F_BUFFER_SELECTED) {
 		struct io_buffer *kbuf;
 
@@ -3906,113 +4256,349 @@ static int io_unlinkat(struct io_kiocb *req, unsigned int issue_flags)
 	return 0;
 }
 
-static int io_shutdown_prep(struct io_kiocb *req,
+static int io_mkdirat_prep(struct io_kiocb *req,
 			    const struct io_uring_sqe *sqe)
 {
-#if defined(CONFIG_NET)
+	struct io_mkdir *mkd = &req->mkdir;
+	const char __user *fname;
+
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
-	if (unlikely(sqe->ioprio || sqe->off || sqe->addr || sqe->rw_flags ||
-		     sqe->buf_index || sqe->splice_fd_in))
+	if (sqe->ioprio || sqe->off || sqe->rw_flags || sqe->buf_index ||
+	    sqe->splice_fd_in)
 		return -EINVAL;
+	if (unlikely(req->flags & REQ_F_FIXED_FILE))
+		return -EBADF;
 
-	req->shutdown.how = READ_ONCE(sqe->len);
+	mkd->dfd = READ_ONCE(sqe->fd);
+	mkd->mode = READ_ONCE(sqe->len);
+
+	fname = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	mkd->filename = getname(fname);
+	if (IS_ERR(mkd->filename))
+		return PTR_ERR(mkd->filename);
+
+	req->flags |= REQ_F_NEED_CLEANUP;
 	return 0;
-#else
-	return -EOPNOTSUPP;
-#endif
 }
 
-static int io_shutdown(struct io_kiocb *req, unsigned int issue_flags)
+static int io_mkdirat(struct io_kiocb *req, unsigned int issue_flags)
 {
-#if defined(CONFIG_NET)
-	struct socket *sock;
+	struct io_mkdir *mkd = &req->mkdir;
 	int ret;
 
 	if (issue_flags & IO_URING_F_NONBLOCK)
 		return -EAGAIN;
 
-	sock = sock_from_file(req->file, &ret);
-	if (unlikely(!sock))
-		return ret;
+	ret = do_mkdirat(mkd->dfd, mkd->filename, mkd->mode);
 
-	ret = __sys_shutdown_sock(sock, req->shutdown.how);
+	req->flags &= ~REQ_F_NEED_CLEANUP;
 	if (ret < 0)
 		req_set_fail(req);
 	io_req_complete(req, ret);
 	return 0;
-#else
-	return -EOPNOTSUPP;
-#endif
 }
 
-static int __io_splice_prep(struct io_kiocb *req,
+static int io_symlinkat_prep(struct io_kiocb *req,
 			    const struct io_uring_sqe *sqe)
 {
-	struct io_splice *sp = &req->splice;
-	unsigned int valid_flags = SPLICE_F_FD_IN_FIXED | SPLICE_F_ALL;
+	struct io_symlink *sl = &req->symlink;
+	const char __user *oldpath, *newpath;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
-
-	sp->len = READ_ONCE(sqe->len);
-	sp->flags = READ_ONCE(sqe->splice_flags);
-	if (unlikely(sp->flags & ~valid_flags))
+	if (sqe->ioprio || sqe->len || sqe->rw_flags || sqe->buf_index ||
+	    sqe->splice_fd_in)
 		return -EINVAL;
-	sp->splice_fd_in = READ_ONCE(sqe->splice_fd_in);
-	return 0;
-}
+	if (unlikely(req->flags & REQ_F_FIXED_FILE))
+		return -EBADF;
 
-static int io_tee_prep(struct io_kiocb *req,
-		       const struct io_uring_sqe *sqe)
-{
-	if (READ_ONCE(sqe->splice_off_in) || READ_ONCE(sqe->off))
-		return -EINVAL;
-	return __io_splice_prep(req, sqe);
+	sl->new_dfd = READ_ONCE(sqe->fd);
+	oldpath = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	newpath = u64_to_user_ptr(READ_ONCE(sqe->addr2));
+
+	sl->oldpath = getname(oldpath);
+	if (IS_ERR(sl->oldpath))
+		return PTR_ERR(sl->oldpath);
+
+	sl->newpath = getname(newpath);
+	if (IS_ERR(sl->newpath)) {
+		putname(sl->oldpath);
+		return PTR_ERR(sl->newpath);
+	}
+
+	req->flags |= REQ_F_NEED_CLEANUP;
+	return 0;
 }
 
-static int io_tee(struct io_kiocb *req, unsigned int issue_flags)
+static int io_symlinkat(struct io_kiocb *req, unsigned int issue_flags)
 {
-	struct io_splice *sp = &req->splice;
-	struct file *out = sp->file_out;
-	unsigned int flags = sp->flags & ~SPLICE_F_FD_IN_FIXED;
-	struct file *in;
-	long ret = 0;
+	struct io_symlink *sl = &req->symlink;
+	int ret;
 
 	if (issue_flags & IO_URING_F_NONBLOCK)
 		return -EAGAIN;
 
-	in = io_file_get(req->ctx, req, sp->splice_fd_in,
-			 (sp->flags & SPLICE_F_FD_IN_FIXED), issue_flags);
-	if (!in) {
-		ret = -EBADF;
-		goto done;
-	}
-
-	if (sp->len)
-		ret = do_tee(in, out, sp->len, flags);
+	ret = do_symlinkat(sl->oldpath, sl->new_dfd, sl->newpath);
 
-	if (!(sp->flags & SPLICE_F_FD_IN_FIXED))
-		io_put_file(in);
-done:
-	if (ret != sp->len)
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+	if (ret < 0)
 		req_set_fail(req);
 	io_req_complete(req, ret);
 	return 0;
 }
 
-static int io_splice_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+static int io_linkat_prep(struct io_kiocb *req,
+			    const struct io_uring_sqe *sqe)
 {
-	struct io_splice *sp = &req->splice;
+	struct io_hardlink *lnk = &req->hardlink;
+	const char __user *oldf, *newf;
 
-	sp->off_in = READ_ONCE(sqe->splice_off_in);
-	sp->off_out = READ_ONCE(sqe->off);
-	return __io_splice_prep(req, sqe);
-}
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->buf_index || sqe->splice_fd_in)
+		return -EINVAL;
+	if (unlikely(req->flags & REQ_F_FIXED_FILE))
+		return -EBADF;
 
-static int io_splice(struct io_kiocb *req, unsigned int issue_flags)
-{
-	struct io_splice *sp = &req->splice;
+	lnk->old_dfd = READ_ONCE(sqe->fd);
+	lnk->new_dfd = READ_ONCE(sqe->len);
+	oldf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	newf = u64_to_user_ptr(READ_ONCE(sqe->addr2));
+	lnk->flags = READ_ONCE(sqe->hardlink_flags);
+
+	lnk->oldpath = getname_flags(oldf,
+			(lnk->flags & AT_EMPTY_PATH) ? LOOKUP_EMPTY : 0, NULL);
+	if (IS_ERR(lnk->oldpath))
+		return PTR_ERR(lnk->oldpath);
+
+	lnk->newpath = getname(newf);
+	if (IS_ERR(lnk->newpath)) {
+		putname(lnk->oldpath);
+		return PTR_ERR(lnk->newpath);
+	}
+
+	req->flags |= REQ_F_NEED_CLEANUP;
+	return 0;
+}
+
+static int io_linkat(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_hardlink *lnk = &req->hardlink;
+	int ret;
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	ret = do_linkat(lnk->old_dfd, lnk->oldpath, lnk->new_dfd,
+				lnk->newpath, lnk->flags);
+
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+	if (ret < 0)
+		req_set_fail(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_getdents_prep(struct io_kiocb *req,
+			    const struct io_uring_sqe *sqe)
+{
+	struct io_getdents *gd = &req->getdents;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->off || sqe->addr2 || sqe->rw_flags ||
+	    sqe->buf_index || sqe->splice_fd_in)
+		return -EINVAL;
+
+	gd->dirent = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	gd->count = READ_ONCE(sqe->len);
+	return 0;
+}
+
+/*
+ * Reads from the current directory position like getdents64(2), so a
+ * directory should only have one of these in flight at a time.
+ */
+static int io_getdents(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_getdents *gd = &req->getdents;
+	struct file *file = req->file;
+	bool pos_lock = file->f_mode & FMODE_ATOMIC_POS;
+	int ret;
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	if (pos_lock)
+		mutex_lock(&file->f_pos_lock);
+	ret = vfs_getdents64(file, gd->dirent, gd->count);
+	if (pos_lock)
+		mutex_unlock(&file->f_pos_lock);
+
+	if (ret < 0)
+		req_set_fail(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_xattr_prep(struct io_kiocb *req,
+			 const struct io_uring_sqe *sqe)
+{
+	struct io_xattr *ix = &req->xattr;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->buf_index || sqe->splice_fd_in)
+		return -EINVAL;
+
+	ix->name = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	ix->value = u64_to_user_ptr(READ_ONCE(sqe->addr2));
+	ix->size = READ_ONCE(sqe->len);
+	ix->flags = READ_ONCE(sqe->xattr_flags);
+	if (req->opcode == IORING_OP_FGETXATTR && ix->flags)
+		return -EINVAL;
+	return 0;
+}
+
+static int io_fgetxattr(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_xattr *ix = &req->xattr;
+	ssize_t ret;
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	ret = file_getxattr(req->file, ix->name, ix->value, ix->size);
+	if (ret < 0)
+		req_set_fail(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_fsetxattr(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_xattr *ix = &req->xattr;
+	int ret;
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	ret = file_setxattr(req->file, ix->name, ix->value, ix->size,
+			    ix->flags);
+	if (ret < 0)
+		req_set_fail(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_shutdown_prep(struct io_kiocb *req,
+			    const struct io_uring_sqe *sqe)
+{
+#if defined(CONFIG_NET)
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->ioprio || sqe->off || sqe->addr || sqe->rw_flags ||
+		     sqe->buf_index || sqe->splice_fd_in))
+		return -EINVAL;
+
+	req->shutdown.how = READ_ONCE(sqe->len);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int io_shutdown(struct io_kiocb *req, unsigned int issue_flags)
+{
+#if defined(CONFIG_NET)
+	struct socket *sock;
+	int ret;
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		return ret;
+
+	ret = __sys_shutdown_sock(sock, req->shutdown.how);
+	if (ret < 0)
+		req_set_fail(req);
+	io_req_complete(req, ret);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int __io_splice_prep(struct io_kiocb *req,
+			    const struct io_uring_sqe *sqe)
+{
+	struct io_splice *sp = &req->splice;
+	unsigned int valid_flags = SPLICE_F_FD_IN_FIXED | SPLICE_F_ALL;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+
+	sp->len = READ_ONCE(sqe->len);
+	sp->flags = READ_ONCE(sqe->splice_flags);
+	if (unlikely(sp->flags & ~valid_flags))
+		return -EINVAL;
+	sp->splice_fd_in = READ_ONCE(sqe->splice_fd_in);
+	return 0;
+}
+
+static int io_tee_prep(struct io_kiocb *req,
+		       const struct io_uring_sqe *sqe)
+{
+	if (READ_ONCE(sqe->splice_off_in) || READ_ONCE(sqe->off))
+		return -EINVAL;
+	return __io_splice_prep(req, sqe);
+}
+
+static int io_tee(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_splice *sp = &req->splice;
+	struct file *out = sp->file_out;
+	unsigned int flags = sp->flags & ~SPLICE_F_FD_IN_FIXED;
+	struct file *in;
+	long ret = 0;
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	in = io_file_get(req->ctx, req, sp->splice_fd_in,
+			 (sp->flags & SPLICE_F_FD_IN_FIXED), issue_flags);
+	if (!in) {
+		ret = -EBADF;
+		goto done;
+	}
+
+	if (sp->len)
+		ret = do_tee(in, out, sp->len, flags);
+
+	if (!(sp->flags & SPLICE_F_FD_IN_FIXED))
+		io_put_file(in);
+done:
+	if (ret != sp->len)
+		req_set_fail(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_splice_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_splice *sp = &req->splice;
+
+	sp->off_in = READ_ONCE(sqe->splice_off_in);
+	sp->off_out = READ_ONCE(sqe->off);
+	return __io_splice_prep(req, sqe);
+}
+
+static int io_splice(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_splice *sp = &req->splice;
 	struct file *out = sp->file_out;
 	unsigned int flags = sp->flags & ~SPLICE_F_FD_IN_FIXED;
 	loff_t *poff_in, *poff_out;
@@ -4409,6 +4995,12 @@ static int io_provide_buffers(struct io_kiocb *req, unsigned int issue_flags)
 
 	lockdep_assert_held(&ctx->uring_lock);
 
+	/* ring mapped groups are refilled by the application directly */
+	if (xa_load(&ctx->io_buf_lists, p->bgid)) {
+		ret = -EEXIST;
+		goto out;
+	}
+
 	list = head = xa_load(&ctx->io_buffers, p->bgid);
 
 	ret = io_add_buffers(p, &head);
@@ -4418,6 +5010,7 @@ static int io_provide_buffers(struct io_kiocb *req, unsigned int issue_flags)
 		if (ret < 0)
 			__io_remove_buffers(ctx, head, p->bgid, -1U);
 	}
+out:
 	if (ret < 0)
 		req_set_fail(req);
 	/* complete before unlock, IOPOLL may need the lock */
@@ -4681,7 +5274,59 @@ static int io_sync_file_range(struct io_kiocb *req, unsigned int issue_flags)
 	return 0;
 }
 
+static void io_notif_complete_work(struct work_struct *work)
+{
+	struct io_notif *notif = container_of(work, struct io_notif, work);
+	struct io_ring_ctx *ctx = notif->ctx;
+
+	io_post_aux_cqe(ctx, notif->user_data, 0, IORING_CQE_F_NOTIF);
+	if (notif->account_pages)
+		io_unaccount_mem(ctx, notif->account_pages);
+	if (notif->rsrc_refs)
+		percpu_ref_put(notif->rsrc_refs);
+	percpu_ref_put(&ctx->refs);
+	kfree(notif);
+}
+
+/*
+ * Called for every skb that drops the notifier and once by the request
+ * itself, may run in softirq context. Punt the CQE to process context,
+ * ->completion_lock isn't irq safe.
+ */
+static void io_tx_zerocopy_callback(struct ubuf_info *uarg, bool success)
+{
+	struct io_notif *notif = container_of(uarg, struct io_notif, uarg);
+
+	if (refcount_dec_and_test(&uarg->refcnt))
+		queue_work(system_unbound_wq, &notif->work);
+}
+
+static inline void io_notif_flush(struct io_notif *notif)
+{
+	io_tx_zerocopy_callback(&notif->uarg, true);
+}
+
 #if defined(CONFIG_NET)
+static struct io_notif *io_alloc_notif(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_notif *notif;
+
+	notif = kzalloc(sizeof(*notif), GFP_KERNEL_ACCOUNT);
+	if (!notif)
+		return NULL;
+
+	notif->uarg.callback = io_tx_zerocopy_callback;
+	notif->uarg.zerocopy = 1;
+	refcount_set(&notif->uarg.refcnt, 1);
+	notif->ctx = ctx;
+	notif->user_data = req->user_data;
+	INIT_WORK(&notif->work, io_notif_complete_work);
+	/* the ring can't go away before all notifications are posted */
+	percpu_ref_get(&ctx->refs);
+	return notif;
+}
+
 static bool io_net_retry(struct socket *sock, int flags)
 {
 	if (!(flags & MSG_WAITALL))
@@ -4837,6 +5482,7 @@ static int io_send(struct io_kiocb *req, unsigned int issue_flags)
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_namelen = 0;
+	msg.msg_ubuf = NULL;
 
 	flags = req->sr_msg.msg_flags;
 	if (issue_flags & IO_URING_F_NONBLOCK)
@@ -4868,37 +5514,169 @@ static int io_send(struct io_kiocb *req, unsigned int issue_flags)
 	return 0;
 }
 
-static int __io_recvmsg_copy_hdr(struct io_kiocb *req,
-				 struct io_async_msghdr *iomsg)
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
-	struct iovec __user *uiov;
-	size_t iov_len;
-	int ret;
+	struct io_ring_ctx *ctx = req->ctx;
 
-	ret = __copy_msghdr_from_user(&iomsg->msg, sr->umsg,
-					&iomsg->uaddr, &uiov, &iov_len);
-	if (ret)
-		return ret;
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->addr2 || sqe->file_index))
+		return -EINVAL;
 
-	if (req->flags & REQ_F_BUFFER_SELECT) {
-		if (iov_len > 1)
-			return -EINVAL;
-		if (copy_from_user(iomsg->fast_iov, uiov, sizeof(*uiov)))
+	sr->flags = READ_ONCE(sqe->ioprio);
+	if (sr->flags & ~IORING_RECVSEND_FIXED_BUF)
+		return -EINVAL;
+	if (sr->flags & IORING_RECVSEND_FIXED_BUF) {
+		u16 index;
+
+		if (unlikely(req->buf_index >= ctx->nr_user_bufs))
 			return -EFAULT;
-		sr->len = iomsg->fast_iov[0].iov_len;
-		iomsg->free_iov = NULL;
-	} else {
-		iomsg->free_iov = iomsg->fast_iov;
-		ret = __import_iovec(READ, uiov, iov_len, UIO_FASTIOV,
-				     &iomsg->free_iov, &iomsg->msg.msg_iter,
-				     false);
-		if (ret > 0)
-			ret = 0;
+		index = array_index_nospec(req->buf_index, ctx->nr_user_bufs);
+		req->imu = ctx->user_bufs[index];
+		io_req_set_rsrc_node(req);
+	} else if (req->buf_index) {
+		return -EINVAL;
 	}
 
-	return ret;
-}
+	sr->buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	sr->len = READ_ONCE(sqe->len);
+	sr->msg_flags = READ_ONCE(sqe->msg_flags) | MSG_NOSIGNAL;
+	if (sr->msg_flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+
+	sr->notif = NULL;
+	sr->done_io = 0;
+	return 0;
+}
+
+static int io_sendzc(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct msghdr msg;
+	struct iovec iov;
+	struct socket *sock;
+	unsigned flags;
+	int min_ret = 0;
+	int ret;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		return ret;
+	/* only TCP knows how to attach msg_ubuf to its skbs */
+	if (sock->sk->sk_protocol != IPPROTO_TCP)
+		return -EOPNOTSUPP;
+
+	if (sr->flags & IORING_RECVSEND_FIXED_BUF)
+		ret = __io_import_fixed(WRITE, &msg.msg_iter, req->imu,
+					(u64)(unsigned long)sr->buf, sr->len);
+	else
+		ret = import_single_range(WRITE, sr->buf, sr->len, &iov,
+					  &msg.msg_iter);
+	if (unlikely(ret))
+		return ret;
+
+	/* kept across retries, skbs of a partial send already hold it */
+	if (!sr->notif) {
+		sr->notif = io_alloc_notif(req);
+		if (!sr->notif)
+			return -ENOMEM;
+		req->flags |= REQ_F_NEED_CLEANUP;
+
+		/*
+		 * The pages stay pinned until the notification fires, charge
+		 * them like SOCK_ZEROCOPY does. Registered buffers already are,
+		 * but their node must outlive the request so the buffer can't
+		 * be unregistered under the skbs.
+		 */
+		if (sr->flags & IORING_RECVSEND_FIXED_BUF) {
+			sr->notif->rsrc_refs = req->fixed_rsrc_refs;
+			percpu_ref_get(sr->notif->rsrc_refs);
+		} else {
+			unsigned long nr_pages;
+
+			nr_pages = DIV_ROUND_UP(offset_in_page(sr->buf) + sr->len,
+						PAGE_SIZE);
+			ret = io_account_mem(req->ctx, nr_pages);
+			if (ret)
+				return ret;
+			sr->notif->account_pages = nr_pages;
+		}
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_ubuf = &sr->notif->uarg;
+
+	flags = sr->msg_flags | MSG_ZEROCOPY;
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		flags |= MSG_DONTWAIT;
+	if (flags & MSG_WAITALL)
+		min_ret = iov_iter_count(&msg.msg_iter);
+
+	msg.msg_flags = flags;
+	ret = sock_sendmsg(sock, &msg);
+	if (ret < min_ret) {
+		if (ret == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+			return -EAGAIN;
+		if (ret == -ERESTARTSYS)
+			ret = -EINTR;
+		if (ret > 0 && io_net_retry(sock, flags)) {
+			sr->len -= ret;
+			sr->buf += ret;
+			sr->done_io += ret;
+			req->flags |= REQ_F_PARTIAL_IO;
+			return -EAGAIN;
+		}
+		req_set_fail(req);
+	}
+	if (ret >= 0)
+		ret += sr->done_io;
+	else if (sr->done_io)
+		ret = sr->done_io;
+
+	/*
+	 * Our notifier reference is dropped by io_clean_op() once the request
+	 * is freed, i.e. after its CQE is filled, so the notification CQE
+	 * can't overtake it even for deferred completions.
+	 */
+	__io_req_complete(req, issue_flags, ret, IORING_CQE_F_MORE);
+	return 0;
+}
+
+static int __io_recvmsg_copy_hdr(struct io_kiocb *req,
+				 struct io_async_msghdr *iomsg)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct iovec __user *uiov;
+	size_t iov_len;
+	int ret;
+
+	ret = __copy_msghdr_from_user(&iomsg->msg, sr->umsg,
+					&iomsg->uaddr, &uiov, &iov_len);
+	if (ret)
+		return ret;
+
+	if (req->flags & REQ_F_BUFFER_SELECT) {
+		if (iov_len > 1)
+			return -EINVAL;
+		if (copy_from_user(iomsg->fast_iov, uiov, sizeof(*uiov)))
+			return -EFAULT;
+		sr->len = iomsg->fast_iov[0].iov_len;
+		iomsg->free_iov = NULL;
+	} else {
+		iomsg->free_iov = iomsg->fast_iov;
+		ret = __import_iovec(READ, uiov, iov_len, UIO_FASTIOV,
+				     &iomsg->free_iov, &iomsg->msg.msg_iter,
+				     false);
+		if (ret > 0)
+			ret = 0;
+	}
+
+	return ret;
+}
 
 static int io_recvmsg_copy_hdr(struct io_kiocb *req,
 			       struct io_async_msghdr *iomsg)
@@ -4908,19 +5686,24 @@ static int io_recvmsg_copy_hdr(struct io_kiocb *req,
 	return __io_recvmsg_copy_hdr(req, iomsg);
 }
 
-static struct io_buffer *io_recv_buffer_select(struct io_kiocb *req,
-					       bool needs_lock)
+static void __user *io_recv_buffer_select(struct io_kiocb *req,
+					  bool needs_lock)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct io_buffer *kbuf;
+	void __user *buf;
+
+	buf = io_ring_buffer_select(req, &sr->len, sr->bgid, needs_lock);
+	if (buf)
+		return buf;
 
 	kbuf = io_buffer_select(req, &sr->len, sr->bgid, sr->kbuf, needs_lock);
 	if (IS_ERR(kbuf))
-		return kbuf;
+		return ERR_CAST(kbuf);
 
 	sr->kbuf = kbuf;
 	req->flags |= REQ_F_BUFFER_SELECTED;
-	return kbuf;
+	return u64_to_user_ptr(kbuf->addr);
 }
 
 static inline unsigned int io_put_recv_kbuf(struct io_kiocb *req)
@@ -4941,13 +5724,12 @@ static int io_recvmsg_prep_async(struct io_kiocb *req)
 static int io_recvmsg_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
+	unsigned int flags;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
 	if (unlikely(sqe->addr2 || sqe->file_index))
 		return -EINVAL;
-	if (unlikely(sqe->addr2 || sqe->file_index || sqe->ioprio))
-		return -EINVAL;
 
 	sr->umsg = u64_to_user_ptr(READ_ONCE(sqe->addr));
 	sr->len = READ_ONCE(sqe->len);
@@ -4956,6 +5738,18 @@ static int io_recvmsg_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	if (sr->msg_flags & MSG_DONTWAIT)
 		req->flags |= REQ_F_NOWAIT;
 
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_RECV_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_RECV_MULTISHOT) {
+		if (req->opcode != IORING_OP_RECV ||
+		    !(req->flags & REQ_F_BUFFER_SELECT))
+			return -EINVAL;
+		if (sr->msg_flags & MSG_WAITALL || sr->len)
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
+
 	sr->done_io = 0;
 	return 0;
 }
@@ -4965,7 +5759,7 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 	struct io_async_msghdr iomsg, *kmsg;
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct socket *sock;
-	struct io_buffer *kbuf;
+	void __user *buf;
 	unsigned flags;
 	int min_ret = 0;
 	int ret, cflags = 0;
@@ -4983,11 +5777,13 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 		kmsg = &iomsg;
 	}
 
-	if (req->flags & REQ_F_BUFFER_SELECT) {
-		kbuf = io_recv_buffer_select(req, !force_nonblock);
-		if (IS_ERR(kbuf))
-			return PTR_ERR(kbuf);
-		kmsg->fast_iov[0].iov_base = u64_to_user_ptr(kbuf->addr);
+	/* a ring buffer stays selected, its iter was saved in async_data */
+	if ((req->flags & (REQ_F_BUFFER_SELECT | REQ_F_BUFFER_RING)) ==
+	    REQ_F_BUFFER_SELECT) {
+		buf = io_recv_buffer_select(req, !force_nonblock);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
+		kmsg->fast_iov[0].iov_base = buf;
 		kmsg->fast_iov[0].iov_len = req->sr_msg.len;
 		iov_iter_init(&kmsg->msg.msg_iter, READ, kmsg->fast_iov,
 				1, req->sr_msg.len);
@@ -5034,7 +5830,6 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 
 static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 {
-	struct io_buffer *kbuf;
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct msghdr msg;
 	void __user *buf = sr->buf;
@@ -5042,18 +5837,26 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 	struct iovec iov;
 	unsigned flags;
 	int min_ret = 0;
-	int ret, cflags = 0;
+	int ret, cflags = 0, nr_loops = 0;
 	bool force_nonblock = issue_flags & IO_URING_F_NONBLOCK;
 
 	sock = sock_from_file(req->file, &ret);
 	if (unlikely(!sock))
 		return ret;
 
-	if (req->flags & REQ_F_BUFFER_SELECT) {
-		kbuf = io_recv_buffer_select(req, !force_nonblock);
-		if (IS_ERR(kbuf))
-			return PTR_ERR(kbuf);
-		buf = u64_to_user_ptr(kbuf->addr);
+retry_multishot:
+	/* a ring buffer stays selected, sr->buf/len track its position */
+	if ((req->flags & (REQ_F_BUFFER_SELECT | REQ_F_BUFFER_RING)) ==
+	    REQ_F_BUFFER_SELECT) {
+		/* multishot fills whole buffers, there is no SQE length */
+		if ((req->flags & REQ_F_APOLL_MULTISHOT) &&
+		    !(req->flags & REQ_F_BUFFER_SELECTED))
+			sr->len = MAX_RW_COUNT;
+		buf = io_recv_buffer_select(req, !force_nonblock);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
+		if (req->flags & REQ_F_BUFFER_RING)
+			sr->buf = buf;
 	}
 
 	ret = import_single_range(READ, buf, sr->len, &iov, &msg.msg_iter);
@@ -5075,8 +5878,12 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 
 	ret = sock_recvmsg(sock, &msg, flags);
 	if (ret < min_ret) {
-		if (ret == -EAGAIN && force_nonblock)
+		if (ret == -EAGAIN && force_nonblock) {
+			/* keep the buffer selected and wait for more data */
+			if (issue_flags & IO_URING_F_MULTISHOT)
+				return 0;
 			return -EAGAIN;
+		}
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
 		if (ret > 0 && io_net_retry(sock, flags)) {
@@ -5097,6 +5904,18 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 		ret += sr->done_io;
 	else if (sr->done_io)
 		ret = sr->done_io;
+
+	/* EOF and errors terminate a multishot recv, as does a lost CQE */
+	if ((req->flags & REQ_F_APOLL_MULTISHOT) && ret > 0 &&
+	    io_post_aux_cqe(req->ctx, req->user_data, ret,
+			    cflags | IORING_CQE_F_MORE)) {
+		cflags = 0;
+		if (++nr_loops < MULTISHOT_MAX_RETRY && !need_resched())
+			goto retry_multishot;
+		return io_multishot_yield(req, issue_flags);
+	}
+	if (issue_flags & IO_URING_F_MULTISHOT)
+		return io_req_stop_multishot(req, ret, cflags);
 	__io_req_complete(req, issue_flags, ret, cflags);
 	return 0;
 }
@@ -5104,10 +5923,11 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_accept *accept = &req->accept;
+	unsigned int flags;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
-	if (sqe->ioprio || sqe->len || sqe->buf_index)
+	if (sqe->len || sqe->buf_index)
 		return -EINVAL;
 
 	accept->addr = u64_to_user_ptr(READ_ONCE(sqe->addr));
@@ -5118,6 +5938,16 @@ static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	accept->file_slot = READ_ONCE(sqe->file_index);
 	if (accept->file_slot && (accept->flags & SOCK_CLOEXEC))
 		return -EINVAL;
+
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_ACCEPT_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_ACCEPT_MULTISHOT) {
+		/* every connection would land in the same fixed slot */
+		if (accept->file_slot)
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
 	if (accept->flags & ~(SOCK_CLOEXEC | SOCK_NONBLOCK))
 		return -EINVAL;
 	if (SOCK_NONBLOCK != O_NONBLOCK && (accept->flags & SOCK_NONBLOCK))
@@ -5132,12 +5962,16 @@ static int io_accept(struct io_kiocb *req, unsigned int issue_flags)
 	unsigned int file_flags = force_nonblock ? O_NONBLOCK : 0;
 	bool fixed = !!accept->file_slot;
 	struct file *file;
-	int ret, fd;
+	int ret, fd, nr_loops = 0;
 
+retry:
 	if (!fixed) {
 		fd = __get_unused_fd_flags(accept->flags, accept->nofile);
-		if (unlikely(fd < 0))
+		if (unlikely(fd < 0)) {
+			if (issue_flags & IO_URING_F_MULTISHOT)
+				return io_req_stop_multishot(req, fd, 0);
 			return fd;
+		}
 	}
 	file = do_accept(req->file, file_flags, accept->addr, accept->addr_len,
 			 accept->flags);
@@ -5148,8 +5982,12 @@ static int io_accept(struct io_kiocb *req, unsigned int issue_flags)
 		ret = PTR_ERR(file);
 		/* safe to retry */
 		req->flags |= REQ_F_PARTIAL_IO;
-		if (ret == -EAGAIN && force_nonblock)
+		if (ret == -EAGAIN && force_nonblock) {
+			/* backlog drained, wait for the next connection */
+			if (issue_flags & IO_URING_F_MULTISHOT)
+				return 0;
 			return -EAGAIN;
+		}
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
 		req_set_fail(req);
@@ -5160,6 +5998,20 @@ static int io_accept(struct io_kiocb *req, unsigned int issue_flags)
 		ret = io_install_fixed_file(req, file, issue_flags,
 					    accept->file_slot - 1);
 	}
+
+	if ((req->flags & REQ_F_APOLL_MULTISHOT) && ret >= 0) {
+		if (io_post_aux_cqe(req->ctx, req->user_data, ret,
+				    IORING_CQE_F_MORE)) {
+			if (++nr_loops < MULTISHOT_MAX_RETRY && !need_resched())
+				goto retry;
+			return io_multishot_yield(req, issue_flags);
+		}
+		/* the fd is installed but its CQE is lost, stop here */
+		ret = -ECANCELED;
+		req_set_fail(req);
+	}
+	if (issue_flags & IO_URING_F_MULTISHOT)
+		return io_req_stop_multishot(req, ret, 0);
 	__io_req_complete(req, issue_flags, ret, 0);
 	return 0;
 }
@@ -5252,6 +6104,7 @@ IO_NETOP_PREP_ASYNC(sendmsg);
 IO_NETOP_PREP_ASYNC(recvmsg);
 IO_NETOP_PREP_ASYNC(connect);
 IO_NETOP_PREP(accept);
+IO_NETOP_PREP(sendzc);
 IO_NETOP_FN(send);
 IO_NETOP_FN(recv);
 #endif /* CONFIG_NET */
@@ -5387,12 +6240,21 @@ static void io_poll_remove_entries(struct io_kiocb *req)
  * Returns a negative error on failure. >0 when no action require, which is
  * either spurious wakeup or multishot CQE is served. 0 when it's done with
  * the request, then the mask is stored in req->result.
+ * IO_POLL_MULTISHOT_DONE when a multishot request terminated, its final
+ * result is in req->result and req->compl.cflags.
+ */
+#define IO_POLL_MULTISHOT_DONE	2
+/*
+ * IO_POLL_REQUEUE when a multishot request yielded, the caller still owns
+ * the request and queues another task_work run for it.
  */
-static int io_poll_check_events(struct io_kiocb *req)
+#define IO_POLL_REQUEUE		3
+
+static int io_poll_check_events(struct io_kiocb *req, bool *locked)
 {
 	struct io_ring_ctx *ctx = req->ctx;
 	struct io_poll_iocb *poll = io_poll_get_single(req);
-	int v;
+	int v, ret;
 
 	/* req->task == current here, checking PF_EXITING is safe */
 	if (unlikely(req->task->flags & PF_EXITING))
@@ -5433,16 +6295,23 @@ static int io_poll_check_events(struct io_kiocb *req)
 		/* multishot, just fill an CQE and proceed */
 		if (req->result && !(poll->events & EPOLLONESHOT)) {
 			__poll_t mask = mangle_poll(req->result & poll->events);
-			bool filled;
 
-			spin_lock(&ctx->completion_lock);
-			filled = io_fill_cqe_aux(ctx, req->user_data, mask,
-						 IORING_CQE_F_MORE);
-			io_commit_cqring(ctx);
-			spin_unlock(&ctx->completion_lock);
-			if (unlikely(!filled))
+			if (req->flags & REQ_F_APOLL_MULTISHOT) {
+				/* reissue, the request posts its own CQEs */
+				io_tw_lock(ctx, locked);
+				ret = io_issue_sqe(req, IO_URING_F_NONBLOCK |
+						   IO_URING_F_MULTISHOT);
+				if (ret == IOU_STOP_MULTISHOT)
+					return IO_POLL_MULTISHOT_DONE;
+				if (ret == IOU_REQUEUE)
+					return IO_POLL_REQUEUE;
+				if (ret < 0)
+					return ret;
+			} else if (unlikely(!io_post_aux_cqe(ctx, req->user_data,
+							     mask,
+							     IORING_CQE_F_MORE))) {
 				return -ECANCELED;
-			io_cqring_ev_posted(ctx);
+			}
 		} else if (req->result) {
 			return 0;
 		}
@@ -5465,7 +6334,7 @@ static void io_poll_task_func(struct io_kiocb *req, bool *locked)
 	struct io_ring_ctx *ctx = req->ctx;
 	int ret;
 
-	ret = io_poll_check_events(req);
+	ret = io_poll_check_events(req, locked);
 	if (ret > 0)
 		return;
 
@@ -5488,8 +6357,13 @@ static void io_apoll_task_func(struct io_kiocb *req, bool *locked)
 	struct io_ring_ctx *ctx = req->ctx;
 	int ret;
 
-	ret = io_poll_check_events(req);
-	if (ret > 0)
+	ret = io_poll_check_events(req, locked);
+	if (ret == IO_POLL_REQUEUE) {
+		/* poll_refs are still held, the next run picks them up */
+		__io_poll_execute(req, 0);
+		return;
+	}
+	if (ret > 0 && ret != IO_POLL_MULTISHOT_DONE)
 		return;
 
 	io_tw_lock(req->ctx, locked);
@@ -5498,7 +6372,9 @@ static void io_apoll_task_func(struct io_kiocb *req, bool *locked)
 	hash_del(&req->hash_node);
 	spin_unlock(&ctx->completion_lock);
 
-	if (!ret)
+	if (ret == IO_POLL_MULTISHOT_DONE)
+		io_req_complete_post(req, req->result, req->compl.cflags);
+	else if (!ret)
 		io_req_task_submit(req, locked);
 	else
 		io_req_complete_failed(req, ret);
@@ -5737,6 +6613,9 @@ static int io_arm_poll_handler(struct io_kiocb *req)
 	} else {
 		mask |= POLLOUT | POLLWRNORM;
 	}
+	/* stay on the waitqueue, the request is reissued for every event */
+	if (req->flags & REQ_F_APOLL_MULTISHOT)
+		mask &= ~EPOLLONESHOT;
 
 	if (req->flags & REQ_F_POLLED) {
 		apoll = req->apoll;
@@ -6471,6 +7350,19 @@ static int io_req_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 		return io_renameat_prep(req, sqe);
 	case IORING_OP_UNLINKAT:
 		return io_unlinkat_prep(req, sqe);
+	case IORING_OP_SEND_ZC:
+		return io_sendzc_prep(req, sqe);
+	case IORING_OP_MKDIRAT:
+		return io_mkdirat_prep(req, sqe);
+	case IORING_OP_SYMLINKAT:
+		return io_symlinkat_prep(req, sqe);
+	case IORING_OP_LINKAT:
+		return io_linkat_prep(req, sqe);
+	case IORING_OP_GETDENTS:
+		return io_getdents_prep(req, sqe);
+	case IORING_OP_FGETXATTR:
+	case IORING_OP_FSETXATTR:
+		return io_xattr_prep(req, sqe);
 	}
 
 	printk_once(KERN_WARNING "io_uring: unhandled opcode %d\n",
@@ -6591,7 +7483,8 @@ static bool io_drain_req(struct io_kiocb *req)
 
 static void io_clean_op(struct io_kiocb *req)
 {
-	if (req->flags & REQ_F_BUFFER_SELECTED) {
+	if ((req->flags & (REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING)) ==
+	    REQ_F_BUFFER_SELECTED) {
 		switch (req->opcode) {
 		case IORING_OP_READV:
 		case IORING_OP_READ_FIXED:
@@ -6637,6 +7530,21 @@ static void io_clean_op(struct io_kiocb *req)
 		case IORING_OP_UNLINKAT:
 			putname(req->unlink.filename);
 			break;
+		case IORING_OP_SEND_ZC:
+			if (req->sr_msg.notif)
+				io_notif_flush(req->sr_msg.notif);
+			break;
+		case IORING_OP_MKDIRAT:
+			putname(req->mkdir.filename);
+			break;
+		case IORING_OP_SYMLINKAT:
+			putname(req->symlink.oldpath);
+			putname(req->symlink.newpath);
+			break;
+		case IORING_OP_LINKAT:
+			putname(req->hardlink.oldpath);
+			putname(req->hardlink.newpath);
+			break;
 		}
 	}
 	if ((req->flags & REQ_F_POLLED) && req->apoll) {
@@ -6696,6 +7604,9 @@ static int io_issue_sqe(struct io_kiocb *req, unsigned int issue_flags)
 	case IORING_OP_SEND:
 		ret = io_send(req, issue_flags);
 		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_sendzc(req, issue_flags);
+		break;
 	case IORING_OP_RECVMSG:
 		ret = io_recvmsg(req, issue_flags);
 		break;
@@ -6765,6 +7676,24 @@ static int io_issue_sqe(struct io_kiocb *req, unsigned int issue_flags)
 	case IORING_OP_UNLINKAT:
 		ret = io_unlinkat(req, issue_flags);
 		break;
+	case IORING_OP_MKDIRAT:
+		ret = io_mkdirat(req, issue_flags);
+		break;
+	case IORING_OP_SYMLINKAT:
+		ret = io_symlinkat(req, issue_flags);
+		break;
+	case IORING_OP_LINKAT:
+		ret = io_linkat(req, issue_flags);
+		break;
+	case IORING_OP_GETDENTS:
+		ret = io_getdents(req, issue_flags);
+		break;
+	case IORING_OP_FGETXATTR:
+		ret = io_fgetxattr(req, issue_flags);
+		break;
+	case IORING_OP_FSETXATTR:
+		ret = io_fsetxattr(req, issue_flags);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -6789,6 +7718,39 @@ static struct io_wq_work *io_wq_free_work(struct io_wq_work *work)
 	return req ? &req->work : NULL;
 }
 
+/*
+ * Multishot requests must not be issued blocking, they'd never give the
+ * worker back. Issue nonblocking and leave the rest to poll, like inline
+ * submission does.
+ */
+static int io_wq_issue_multishot(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	int ret;
+
+	if (!req->file || !file_can_poll(req->file))
+		return -EBADFD;
+
+	mutex_lock(&ctx->uring_lock);
+	do {
+		ret = io_issue_sqe(req, IO_URING_F_NONBLOCK);
+		if (ret != -EAGAIN || (req->flags & REQ_F_NOWAIT))
+			break;
+		switch (io_arm_poll_handler(req)) {
+		case IO_APOLL_OK:
+			ret = 0;
+			break;
+		case IO_APOLL_ABORTED:
+			ret = -ECANCELED;
+			break;
+		case IO_APOLL_READY:
+			continue;
+		}
+	} while (ret == -EAGAIN);
+	mutex_unlock(&ctx->uring_lock);
+	return ret;
+}
+
 static void io_wq_submit_work(struct io_wq_work *work)
 {
 	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
@@ -6809,7 +7771,9 @@ static void io_wq_submit_work(struct io_wq_work *work)
 	if (work->flags & IO_WQ_WORK_CANCEL)
 		ret = -ECANCELED;
 
-	if (!ret) {
+	if (!ret && (req->flags & REQ_F_APOLL_MULTISHOT)) {
+		ret = io_wq_issue_multishot(req);
+	} else if (!ret) {
 		do {
 			ret = io_issue_sqe(req, 0);
 			/*
@@ -7096,6 +8060,8 @@ static int io_init_req(struct io_ring_ctx *ctx, struct io_kiocb *req,
 		return -EINVAL;
 	if (unlikely(req->opcode >= IORING_OP_LAST))
 		return -EINVAL;
+	if (unlikely(io_op_defs[req->opcode].not_supported))
+		return -EINVAL;
 	if (!io_check_restriction(ctx, req, sqe_flags))
 		return -EACCES;
 
@@ -7121,7 +8087,7 @@ static int io_init_req(struct io_ring_ctx *ctx, struct io_kiocb *req,
 	 */
 	if (!state->plug_started && state->ios_left > 1 &&
 	    io_op_defs[req->opcode].plug) {
-		blk_start_plug(&state->plug);
+		blk_start_plug_nr_ios(&state->plug, state->ios_left);
 		state->plug_started = true;
 	}
 
@@ -7366,8 +8332,11 @@ static int __io_sq_thread(struct io_ring_ctx *ctx, bool cap_entries)
 
 	to_submit = io_sqring_entries(ctx);
 	/* if we're handling multiple rings, cap submit size for fairness */
-	if (cap_entries && to_submit > IORING_SQPOLL_CAP_ENTRIES_VALUE)
-		to_submit = IORING_SQPOLL_CAP_ENTRIES_VALUE;
+	if (cap_entries) {
+		unsigned int quota = ctx->sq_quota ?: IORING_SQPOLL_CAP_ENTRIES_VALUE;
+
+		to_submit = min(to_submit, quota);
+	}
 
 	if (!list_empty(&ctx->iopoll_list) || to_submit) {
 		unsigned nr_events = 0;
@@ -7455,9 +8424,14 @@ static int io_sq_thread(void *data)
 		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
 			int ret = __io_sq_thread(ctx, cap_entries);
 
+			if (ret > 0)
+				sqd->submitted += ret;
 			if (!sqt_spin && (ret > 0 || !list_empty(&ctx->iopoll_list)))
 				sqt_spin = true;
 		}
+		/* don't let the first ring always go ahead of the others */
+		if (cap_entries)
+			list_rotate_left(&sqd->ctx_list);
 		if (io_run_task_work())
 			sqt_spin = true;
 
@@ -7465,6 +8439,8 @@ static int io_sq_thread(void *data)
 			cond_resched();
 			if (sqt_spin)
 				timeout = jiffies + sqd->sq_thread_idle;
+			else
+				sqd->idle_spins++;
 			continue;
 		}
 
@@ -7490,6 +8466,7 @@ static int io_sq_thread(void *data)
 				mutex_unlock(&sqd->lock);
 				schedule();
 				mutex_lock(&sqd->lock);
+				sqd->wakeups++;
 			}
 			list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
 				io_ring_clear_wakeup_flag(ctx);
@@ -7604,8 +8581,9 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 			  struct __kernel_timespec __user *uts)
 {
 	struct io_wait_queue iowq;
-	struct io_rings *rings = ctx->rings;
+	struct io_rings *rings;
 	ktime_t timeout = KTIME_MAX;
+	unsigned int head, tail;
 	int ret;
 
 	do {
@@ -7636,7 +8614,9 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 	INIT_LIST_HEAD(&iowq.wq.entry);
 	iowq.ctx = ctx;
 	iowq.nr_timeouts = atomic_read(&ctx->cq_timeouts);
-	iowq.cq_tail = READ_ONCE(ctx->rings->cq.head) + min_events;
+	rcu_read_lock();
+	iowq.cq_tail = READ_ONCE(READ_ONCE(ctx->rings)->cq.head) + min_events;
+	rcu_read_unlock();
 
 	trace_io_uring_cqring_wait(ctx, min_events);
 	do {
@@ -7654,7 +8634,12 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 
 	restore_saved_sigmask_unless(ret == -EINTR);
 
-	return READ_ONCE(rings->cq.head) == READ_ONCE(rings->cq.tail) ? ret : 0;
+	rcu_read_lock();
+	rings = READ_ONCE(ctx->rings);
+	head = READ_ONCE(rings->cq.head);
+	tail = READ_ONCE(rings->cq.tail);
+	rcu_read_unlock();
+	return head == tail ? ret : 0;
 }
 
 static void io_free_page_table(void **table, size_t size)
@@ -8603,6 +9588,7 @@ static int io_uring_alloc_task_context(struct task_struct *task,
 	task->io_uring = tctx;
 	spin_lock_init(&tctx->task_lock);
 	INIT_WQ_LIST(&tctx->task_list);
+	INIT_WQ_LIST(&tctx->compl_list);
 	init_task_work(&tctx->task_work, tctx_task_work);
 	return 0;
 }
@@ -8775,6 +9761,79 @@ static void *io_mem_alloc(size_t size)
 	return (void *) __get_free_pages(gfp, get_order(size));
 }
 
+static void io_pages_unmap(struct page **pages, unsigned int npages)
+{
+	unpin_user_pages(pages, npages);
+	kvfree(pages);
+}
+
+/*
+ * Pin @size bytes of application memory at @uaddr to back a ring. The ring
+ * code addresses it linearly, so the range must be physically contiguous,
+ * which in practice means a single page or a huge page.
+ */
+static void *io_uaddr_map(struct page ***pages, unsigned int *npages,
+			  unsigned long uaddr, size_t size)
+{
+	struct page **page_array;
+	unsigned int nr_pages;
+	void *page_addr;
+	int ret, i;
+
+	if (!uaddr || (uaddr & ~PAGE_MASK) || !size)
+		return ERR_PTR(-EINVAL);
+	nr_pages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	if (nr_pages > INT_MAX)
+		return ERR_PTR(-EOVERFLOW);
+
+	page_array = kvmalloc_array(nr_pages, sizeof(struct page *),
+				    GFP_KERNEL_ACCOUNT);
+	if (!page_array)
+		return ERR_PTR(-ENOMEM);
+
+	ret = pin_user_pages_fast(uaddr, nr_pages, FOLL_WRITE | FOLL_LONGTERM,
+				  page_array);
+	if (ret != nr_pages) {
+		if (ret > 0)
+			unpin_user_pages(page_array, ret);
+		kvfree(page_array);
+		return ERR_PTR(ret < 0 ? ret : -EFAULT);
+	}
+
+	page_addr = page_address(page_array[0]);
+	for (i = 0; i < nr_pages; i++) {
+		if (PageHighMem(page_array[i]) ||
+		    page_address(page_array[i]) != page_addr) {
+			io_pages_unmap(page_array, nr_pages);
+			return ERR_PTR(-EINVAL);
+		}
+		page_addr += PAGE_SIZE;
+	}
+
+	*pages = page_array;
+	*npages = nr_pages;
+	return page_address(page_array[0]);
+}
+
+static void io_rings_free(struct io_ring_ctx *ctx)
+{
+	if (!(ctx->flags & IORING_SETUP_NO_MMAP)) {
+		io_mem_free(ctx->rings);
+		io_mem_free(ctx->sq_sqes);
+	} else {
+		if (ctx->ring_pages) {
+			io_unaccount_mem(ctx, ctx->n_ring_pages);
+			io_pages_unmap(ctx->ring_pages, ctx->n_ring_pages);
+		}
+		if (ctx->sqe_pages)
+			io_pages_unmap(ctx->sqe_pages, ctx->n_sqe_pages);
+		ctx->ring_pages = NULL;
+		ctx->sqe_pages = NULL;
+	}
+	ctx->rings = NULL;
+	ctx->sq_sqes = NULL;
+}
+
 static unsigned long rings_size(unsigned sq_entries, unsigned cq_entries,
 				size_t *sq_offset)
 {
@@ -9216,13 +10275,26 @@ static int io_eventfd_unregister(struct io_ring_ctx *ctx)
 	return -ENXIO;
 }
 
+static void io_free_buf_list(struct io_buffer_list *bl)
+{
+	unpin_user_pages(bl->buf_pages, bl->buf_nr_pages);
+	kvfree(bl->buf_pages);
+	kfree(bl);
+}
+
 static void io_destroy_buffers(struct io_ring_ctx *ctx)
 {
+	struct io_buffer_list *bl;
 	struct io_buffer *buf;
 	unsigned long index;
 
 	xa_for_each(&ctx->io_buffers, index, buf)
 		__io_remove_buffers(ctx, buf, index, -1U);
+
+	xa_for_each(&ctx->io_buf_lists, index, bl) {
+		xa_erase(&ctx->io_buf_lists, index);
+		io_free_buf_list(bl);
+	}
 }
 
 static void io_req_cache_free(struct list_head *list)
@@ -9296,13 +10368,15 @@ static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 #endif
 	WARN_ON_ONCE(!list_empty(&ctx->ltimeout_list));
 
+	/* NO_MMAP rings are charged to mm_account, release them first */
+	io_rings_free(ctx);
+
 	if (ctx->mm_account) {
 		mmdrop(ctx->mm_account);
 		ctx->mm_account = NULL;
 	}
-
-	io_mem_free(ctx->rings);
-	io_mem_free(ctx->sq_sqes);
+	if (ctx->submitter_task)
+		put_task_struct(ctx->submitter_task);
 
 	percpu_ref_exit(&ctx->refs);
 	free_uid(ctx->user);
@@ -9667,6 +10741,11 @@ static int __io_uring_add_tctx_node(struct io_ring_ctx *ctx)
 			if (ret)
 				return ret;
 		}
+		if (ctx->iowq_idle_ms) {
+			unsigned int msecs = ctx->iowq_idle_ms;
+
+			io_wq_idle_timeout(tctx->io_wq, &msecs);
+		}
 	}
 	if (!xa_load(&tctx->xa, (unsigned long)ctx)) {
 		node = kmalloc(sizeof(*node), GFP_KERNEL);
@@ -9824,8 +10903,22 @@ static void io_uring_cancel_generic(bool cancel_all, struct io_sq_data *sqd)
 	}
 }
 
+static void io_uring_unreg_ringfd(void)
+{
+	struct io_uring_task *tctx = current->io_uring;
+	int i;
+
+	for (i = 0; i < IO_RINGFD_REG_MAX; i++) {
+		if (tctx->registered_rings[i]) {
+			fput(tctx->registered_rings[i]);
+			tctx->registered_rings[i] = NULL;
+		}
+	}
+}
+
 void __io_uring_cancel(bool cancel_all)
 {
+	io_uring_unreg_ringfd();
 	io_uring_cancel_generic(cancel_all, NULL);
 }
 
@@ -9837,6 +10930,10 @@ static void *io_uring_validate_mmap_request(struct file *file,
 	struct page *page;
 	void *ptr;
 
+	/* the application already has the memory mapped */
+	if (ctx->flags & IORING_SETUP_NO_MMAP)
+		return ERR_PTR(-EINVAL);
+
 	switch (offset) {
 	case IORING_OFF_SQ_RING:
 	case IORING_OFF_CQ_RING:
@@ -9961,16 +11058,33 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	io_run_task_work();
 
 	if (unlikely(flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
-			       IORING_ENTER_SQ_WAIT | IORING_ENTER_EXT_ARG)))
+			       IORING_ENTER_SQ_WAIT | IORING_ENTER_EXT_ARG |
+			       IORING_ENTER_REGISTERED_RING)))
 		return -EINVAL;
 
-	f = fdget(fd);
-	if (unlikely(!f.file))
-		return -EBADF;
+	/*
+	 * Ring fd has been registered via IORING_REGISTER_RING_FDS, we
+	 * need only dereference our task private array to find it.
+	 */
+	if (flags & IORING_ENTER_REGISTERED_RING) {
+		struct io_uring_task *tctx = current->io_uring;
 
-	ret = -EOPNOTSUPP;
-	if (unlikely(f.file->f_op != &io_uring_fops))
-		goto out_fput;
+		if (unlikely(!tctx || fd >= IO_RINGFD_REG_MAX))
+			return -EINVAL;
+		fd = array_index_nospec(fd, IO_RINGFD_REG_MAX);
+		f.file = tctx->registered_rings[fd];
+		f.flags = 0;
+		if (unlikely(!f.file))
+			return -EBADF;
+	} else {
+		f = fdget(fd);
+		if (unlikely(!f.file))
+			return -EBADF;
+	}
+
+	ret = -EOPNOTSUPP;
+	if (unlikely(f.file->f_op != &io_uring_fops))
+		goto out_fput;
 
 	ret = -ENXIO;
 	ctx = f.file->private_data;
@@ -9981,6 +11095,15 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	if (unlikely(ctx->flags & IORING_SETUP_R_DISABLED))
 		goto out;
 
+	/*
+	 * Deferred completions only run from the submitter's task_work, any
+	 * other task could submit or wait for them indefinitely.
+	 */
+	ret = -EEXIST;
+	if (unlikely((ctx->flags & IORING_SETUP_DEFER_TASKRUN) &&
+		     ctx->submitter_task != current))
+		goto out;
+
 	/*
 	 * For SQ polling, the thread will do all submissions and completions.
 	 * Just return the requested submit count, and wake the thread if
@@ -10040,7 +11163,8 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 out:
 	percpu_ref_put(&ctx->refs);
 out_fput:
-	fdput(f);
+	if (!(flags & IORING_ENTER_REGISTERED_RING))
+		fdput(f);
 	return submitted ? submitted : ret;
 }
 
@@ -10080,6 +11204,7 @@ static int io_uring_show_cred(struct seq_file *m, unsigned int id,
 static void __io_uring_show_fdinfo(struct io_ring_ctx *ctx, struct seq_file *m)
 {
 	int sq_pid = -1, sq_cpu = -1;
+	u64 sq_submitted = 0, sq_idle_spins = 0, sq_wakeups = 0;
 	bool has_lock;
 	int i;
 
@@ -10099,12 +11224,23 @@ static void __io_uring_show_fdinfo(struct io_ring_ctx *ctx, struct seq_file *m)
 				sq_pid = task_pid_nr(sq->thread);
 				sq_cpu = task_cpu(sq->thread);
 			}
+			sq_submitted = sq->submitted;
+			sq_idle_spins = sq->idle_spins;
+			sq_wakeups = sq->wakeups;
 			mutex_unlock(&sq->lock);
 		}
 	}
 
 	seq_printf(m, "SqThread:\t%d\n", sq_pid);
 	seq_printf(m, "SqThreadCpu:\t%d\n", sq_cpu);
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		seq_printf(m, "SqQuota:\t%u\n", ctx->sq_quota);
+		seq_printf(m, "SqIdleMs:\t%u\n",
+			   jiffies_to_msecs(ctx->sq_thread_idle));
+		seq_printf(m, "SqSubmitted:\t%llu\n", sq_submitted);
+		seq_printf(m, "SqIdleSpins:\t%llu\n", sq_idle_spins);
+		seq_printf(m, "SqWakeups:\t%llu\n", sq_wakeups);
+	}
 	seq_printf(m, "UserFiles:\t%u\n", ctx->nr_user_files);
 	for (i = 0; has_lock && i < ctx->nr_user_files; i++) {
 		struct file *f = io_file_from_index(ctx, i);
@@ -10173,6 +11309,8 @@ static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
 {
 	struct io_rings *rings;
 	size_t size, sq_array_offset;
+	void *ptr;
+	int ret;
 
 	/* make sure these are sane, as we already accounted them */
 	ctx->sq_entries = p->sq_entries;
@@ -10182,10 +11320,26 @@ static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
 	if (size == SIZE_MAX)
 		return -EOVERFLOW;
 
-	rings = io_mem_alloc(size);
-	if (!rings)
-		return -ENOMEM;
+	if (!(ctx->flags & IORING_SETUP_NO_MMAP))
+		rings = io_mem_alloc(size) ?: ERR_PTR(-ENOMEM);
+	else
+		rings = io_uaddr_map(&ctx->ring_pages, &ctx->n_ring_pages,
+				     p->cq_off.user_addr, size);
+	if (IS_ERR(rings))
+		return PTR_ERR(rings);
+
+	/* user memory backing the rings stays pinned, charge it */
+	if (ctx->flags & IORING_SETUP_NO_MMAP) {
+		ret = io_account_mem(ctx, ctx->n_ring_pages);
+		if (ret) {
+			io_pages_unmap(ctx->ring_pages, ctx->n_ring_pages);
+			ctx->ring_pages = NULL;
+			return ret;
+		}
+	}
 
+	/* application memory isn't necessarily zeroed */
+	memset(rings, 0, offsetof(struct io_rings, cqes));
 	ctx->rings = rings;
 	ctx->sq_array = (u32 *)((char *)rings + sq_array_offset);
 	rings->sq_ring_mask = p->sq_entries - 1;
@@ -10195,21 +11349,46 @@ static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
 
 	size = array_size(sizeof(struct io_uring_sqe), p->sq_entries);
 	if (size == SIZE_MAX) {
-		io_mem_free(ctx->rings);
-		ctx->rings = NULL;
+		io_rings_free(ctx);
 		return -EOVERFLOW;
 	}
 
-	ctx->sq_sqes = io_mem_alloc(size);
-	if (!ctx->sq_sqes) {
-		io_mem_free(ctx->rings);
-		ctx->rings = NULL;
-		return -ENOMEM;
+	if (!(ctx->flags & IORING_SETUP_NO_MMAP))
+		ptr = io_mem_alloc(size) ?: ERR_PTR(-ENOMEM);
+	else
+		ptr = io_uaddr_map(&ctx->sqe_pages, &ctx->n_sqe_pages,
+				   p->sq_off.user_addr, size);
+	if (IS_ERR(ptr)) {
+		io_rings_free(ctx);
+		return PTR_ERR(ptr);
 	}
+	ctx->sq_sqes = ptr;
 
 	return 0;
 }
 
+static void io_fill_ring_offsets(struct io_ring_ctx *ctx,
+				 struct io_uring_params *p)
+{
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_rings, sq.head);
+	p->sq_off.tail = offsetof(struct io_rings, sq.tail);
+	p->sq_off.ring_mask = offsetof(struct io_rings, sq_ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_rings, sq_ring_entries);
+	p->sq_off.flags = offsetof(struct io_rings, sq_flags);
+	p->sq_off.dropped = offsetof(struct io_rings, sq_dropped);
+	p->sq_off.array = (char *)ctx->sq_array - (char *)ctx->rings;
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_rings, cq.head);
+	p->cq_off.tail = offsetof(struct io_rings, cq.tail);
+	p->cq_off.ring_mask = offsetof(struct io_rings, cq_ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_rings, cq_ring_entries);
+	p->cq_off.overflow = offsetof(struct io_rings, cq_overflow);
+	p->cq_off.cqes = offsetof(struct io_rings, cqes);
+	p->cq_off.flags = offsetof(struct io_rings, cq_flags);
+}
+
 static int io_uring_install_fd(struct io_ring_ctx *ctx, struct file *file)
 {
 	int ret, fd;
@@ -10318,6 +11497,11 @@ static int io_uring_create(unsigned entries, struct io_uring_params *p,
 	mmgrab(current->mm);
 	ctx->mm_account = current->mm;
 
+	/* a disabled ring is bound to the task enabling it */
+	if ((ctx->flags & IORING_SETUP_DEFER_TASKRUN) &&
+	    !(ctx->flags & IORING_SETUP_R_DISABLED))
+		ctx->submitter_task = get_task_struct(current);
+
 	ret = io_allocate_scq_urings(ctx, p);
 	if (ret)
 		goto err;
@@ -10331,23 +11515,7 @@ static int io_uring_create(unsigned entries, struct io_uring_params *p,
 		goto err;
 	io_rsrc_node_switch(ctx, NULL);
 
-	memset(&p->sq_off, 0, sizeof(p->sq_off));
-	p->sq_off.head = offsetof(struct io_rings, sq.head);
-	p->sq_off.tail = offsetof(struct io_rings, sq.tail);
-	p->sq_off.ring_mask = offsetof(struct io_rings, sq_ring_mask);
-	p->sq_off.ring_entries = offsetof(struct io_rings, sq_ring_entries);
-	p->sq_off.flags = offsetof(struct io_rings, sq_flags);
-	p->sq_off.dropped = offsetof(struct io_rings, sq_dropped);
-	p->sq_off.array = (char *)ctx->sq_array - (char *)ctx->rings;
-
-	memset(&p->cq_off, 0, sizeof(p->cq_off));
-	p->cq_off.head = offsetof(struct io_rings, cq.head);
-	p->cq_off.tail = offsetof(struct io_rings, cq.tail);
-	p->cq_off.ring_mask = offsetof(struct io_rings, cq_ring_mask);
-	p->cq_off.ring_entries = offsetof(struct io_rings, cq_ring_entries);
-	p->cq_off.overflow = offsetof(struct io_rings, cq_overflow);
-	p->cq_off.cqes = offsetof(struct io_rings, cqes);
-	p->cq_off.flags = offsetof(struct io_rings, cq_flags);
+	io_fill_ring_offsets(ctx, p);
 
 	p->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
 			IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS |
@@ -10405,7 +11573,16 @@ static long io_uring_setup(u32 entries, struct io_uring_params __user *params)
 	if (p.flags & ~(IORING_SETUP_IOPOLL | IORING_SETUP_SQPOLL |
 			IORING_SETUP_SQ_AFF | IORING_SETUP_CQSIZE |
 			IORING_SETUP_CLAMP | IORING_SETUP_ATTACH_WQ |
-			IORING_SETUP_R_DISABLED))
+			IORING_SETUP_R_DISABLED | IORING_SETUP_DEFER_TASKRUN |
+			IORING_SETUP_HYBRID_IOPOLL | IORING_SETUP_NO_MMAP))
+		return -EINVAL;
+	/* SQPOLL completes from its own thread, there is nothing to defer */
+	if ((p.flags & (IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SQPOLL)) ==
+			(IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SQPOLL))
+		return -EINVAL;
+	/* hybrid polling is a variant of IOPOLL, it makes no sense without */
+	if ((p.flags & (IORING_SETUP_IOPOLL | IORING_SETUP_HYBRID_IOPOLL)) ==
+			IORING_SETUP_HYBRID_IOPOLL)
 		return -EINVAL;
 
 	return  io_uring_create(entries, &p, params);
@@ -10551,6 +11728,9 @@ static int io_register_enable_rings(struct io_ring_ctx *ctx)
 	if (ctx->restrictions.registered)
 		ctx->restricted = 1;
 
+	if ((ctx->flags & IORING_SETUP_DEFER_TASKRUN) && !ctx->submitter_task)
+		ctx->submitter_task = get_task_struct(current);
+
 	ctx->flags &= ~IORING_SETUP_R_DISABLED;
 	if (ctx->sq_data && wq_has_sleeper(&ctx->sq_data->wait))
 		wake_up(&ctx->sq_data->wait);
@@ -10757,6 +11937,442 @@ static int io_register_iowq_max_workers(struct io_ring_ctx *ctx,
 	return ret;
 }
 
+static int io_register_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_list *bl;
+	struct page **pages;
+	unsigned long start, end, ubuf;
+	size_t ring_size;
+	int ret, pret, nr_pages;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+	if (!reg.ring_addr)
+		return -EFAULT;
+	if (reg.ring_addr & ~PAGE_MASK)
+		return -EINVAL;
+	if (!is_power_of_2(reg.ring_entries))
+		return -EINVAL;
+	/* cannot disambiguate full vs empty due to head/tail size */
+	if (reg.ring_entries >= 65536)
+		return -EINVAL;
+
+	if (xa_load(&ctx->io_buf_lists, reg.bgid) ||
+	    xa_load(&ctx->io_buffers, reg.bgid))
+		return -EEXIST;
+
+	ring_size = reg.ring_entries * sizeof(struct io_uring_buf);
+	ubuf = reg.ring_addr;
+	end = (ubuf + ring_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	start = ubuf >> PAGE_SHIFT;
+	nr_pages = end - start;
+
+	bl = kzalloc(sizeof(*bl), GFP_KERNEL_ACCOUNT);
+	if (!bl)
+		return -ENOMEM;
+	pages = kvmalloc_array(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!pages) {
+		kfree(bl);
+		return -ENOMEM;
+	}
+
+	mmap_read_lock(current->mm);
+	pret = pin_user_pages(ubuf, nr_pages, FOLL_WRITE | FOLL_LONGTERM,
+			      pages, NULL);
+	mmap_read_unlock(current->mm);
+	if (pret != nr_pages) {
+		if (pret > 0)
+			unpin_user_pages(pages, pret);
+		ret = pret < 0 ? pret : -EFAULT;
+		goto err;
+	}
+
+	bl->buf_pages = pages;
+	bl->buf_nr_pages = nr_pages;
+	bl->buf_ring = page_address(pages[0]);
+	bl->bgid = reg.bgid;
+	bl->nr_entries = reg.ring_entries;
+	bl->mask = reg.ring_entries - 1;
+	bl->head = 0;
+
+	ret = xa_insert(&ctx->io_buf_lists, reg.bgid, bl, GFP_KERNEL_ACCOUNT);
+	if (!ret)
+		return 0;
+
+	unpin_user_pages(pages, nr_pages);
+err:
+	kvfree(pages);
+	kfree(bl);
+	return ret;
+}
+
+static int io_unregister_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_list *bl;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+
+	bl = xa_erase(&ctx->io_buf_lists, reg.bgid);
+	if (!bl)
+		return -ENOENT;
+	io_free_buf_list(bl);
+	return 0;
+}
+
+static int io_ring_add_registered_fd(struct io_uring_task *tctx, int fd,
+				     int start, int end)
+{
+	struct file *file;
+	int offset;
+
+	for (offset = start; offset < end; offset++) {
+		offset = array_index_nospec(offset, IO_RINGFD_REG_MAX);
+		if (tctx->registered_rings[offset])
+			continue;
+
+		file = fget(fd);
+		if (!file)
+			return -EBADF;
+		if (file->f_op != &io_uring_fops) {
+			fput(file);
+			return -EOPNOTSUPP;
+		}
+		tctx->registered_rings[offset] = file;
+		return offset;
+	}
+
+	return -EBUSY;
+}
+
+/*
+ * Register a ring fd to avoid fdget/fdput for each io_uring_enter()
+ * invocation. User passes in an array of struct io_uring_rsrc_update
+ * with ->data set to the ring_fd, and ->offset given for the desired
+ * index. If no index is desired, application may set ->offset == -1U
+ * and we'll find an available index. Returns number of entries
+ * successfully processed, or < 0 on error if none were processed.
+ */
+static int io_ringfd_register(struct io_ring_ctx *ctx, void __user *__arg,
+			      unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_rsrc_update reg;
+	struct io_uring_task *tctx;
+	int ret, i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+
+	mutex_unlock(&ctx->uring_lock);
+	ret = io_uring_add_tctx_node(ctx);
+	mutex_lock(&ctx->uring_lock);
+	if (ret)
+		return ret;
+
+	tctx = current->io_uring;
+	for (i = 0; i < nr_args; i++) {
+		int start, end;
+
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (reg.offset == -1U) {
+			start = 0;
+			end = IO_RINGFD_REG_MAX;
+		} else {
+			if (reg.offset >= IO_RINGFD_REG_MAX) {
+				ret = -EINVAL;
+				break;
+			}
+			start = reg.offset;
+			end = start + 1;
+		}
+
+		ret = io_ring_add_registered_fd(tctx, reg.data, start, end);
+		if (ret < 0)
+			break;
+
+		reg.offset = ret;
+		if (copy_to_user(&arg[i], &reg, sizeof(reg))) {
+			fput(tctx->registered_rings[reg.offset]);
+			tctx->registered_rings[reg.offset] = NULL;
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_ringfd_unregister(struct io_ring_ctx *ctx, void __user *__arg,
+				unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_task *tctx = current->io_uring;
+	struct io_uring_rsrc_update reg;
+	int ret = 0, i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+	if (!tctx)
+		return 0;
+
+	for (i = 0; i < nr_args; i++) {
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data || reg.offset >= IO_RINGFD_REG_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		reg.offset = array_index_nospec(reg.offset, IO_RINGFD_REG_MAX);
+		if (tctx->registered_rings[reg.offset]) {
+			fput(tctx->registered_rings[reg.offset]);
+			tctx->registered_rings[reg.offset] = NULL;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_register_sqpoll_quota(struct io_ring_ctx *ctx,
+				    void __user *arg)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_sq_data *sqd = ctx->sq_data;
+	__u32 vals[2], old[2];
+
+	if (!(ctx->flags & IORING_SETUP_SQPOLL) || !sqd)
+		return -EINVAL;
+	if (copy_from_user(vals, arg, sizeof(vals)))
+		return -EFAULT;
+	if (vals[0] > ctx->sq_entries || vals[1] > INT_MAX)
+		return -EINVAL;
+
+	/* see io_register_iowq_max_workers() for the locking dance */
+	refcount_inc(&sqd->refs);
+	mutex_unlock(&ctx->uring_lock);
+	mutex_lock(&sqd->lock);
+	mutex_lock(&ctx->uring_lock);
+
+	/* zero leaves the value as is, the old values are returned */
+	old[0] = ctx->sq_quota;
+	old[1] = jiffies_to_msecs(ctx->sq_thread_idle);
+	if (vals[0])
+		ctx->sq_quota = vals[0];
+	if (vals[1]) {
+		ctx->sq_thread_idle = msecs_to_jiffies(vals[1]) ?: 1;
+		io_sqd_update_thread_idle(sqd);
+	}
+
+	mutex_unlock(&sqd->lock);
+	io_put_sq_data(sqd);
+
+	if (copy_to_user(arg, old, sizeof(old)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Like IORING_REGISTER_IOWQ_MAX_WORKERS this configures the io-wq of the tasks
+ * attached to @ctx, not @ctx itself. io-wq is shared by all rings of a task,
+ * so the last registration on any of them wins.
+ */
+static int io_register_iowq_idle_timeout(struct io_ring_ctx *ctx,
+					 void __user *arg)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_tctx_node *node;
+	struct io_uring_task *tctx = NULL;
+	struct io_sq_data *sqd = NULL;
+	__u32 msecs;
+
+	if (copy_from_user(&msecs, arg, sizeof(msecs)))
+		return -EFAULT;
+	if (msecs > INT_MAX)
+		return -EINVAL;
+
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		sqd = ctx->sq_data;
+		if (sqd) {
+			/* see io_register_iowq_max_workers() */
+			refcount_inc(&sqd->refs);
+			mutex_unlock(&ctx->uring_lock);
+			mutex_lock(&sqd->lock);
+			mutex_lock(&ctx->uring_lock);
+			if (sqd->thread)
+				tctx = sqd->thread->io_uring;
+		}
+	} else {
+		tctx = current->io_uring;
+	}
+
+	if (msecs)
+		ctx->iowq_idle_ms = msecs;
+
+	if (tctx && tctx->io_wq)
+		io_wq_idle_timeout(tctx->io_wq, &msecs);
+	else
+		msecs = 0;
+
+	if (sqd) {
+		mutex_unlock(&sqd->lock);
+		io_put_sq_data(sqd);
+	}
+
+	if (copy_to_user(arg, &msecs, sizeof(msecs)))
+		return -EFAULT;
+
+	/* that's it for SQPOLL, only the SQPOLL task creates requests */
+	if (sqd || !ctx->iowq_idle_ms)
+		return 0;
+
+	/* now propagate the timeout to all registered users */
+	list_for_each_entry(node, &ctx->tctx_list, ctx_node) {
+		struct io_uring_task *tctx = node->task->io_uring;
+
+		if (WARN_ON_ONCE(!tctx->io_wq))
+			continue;
+
+		msecs = ctx->iowq_idle_ms;
+		io_wq_idle_timeout(tctx->io_wq, &msecs);
+	}
+	return 0;
+}
+
+/*
+ * Move the SQ/CQ rings to new application memory with a different number of
+ * CQ entries, keeping any unreaped CQEs. Only supported for rings with
+ * application provided memory, as a previous mmap() of kernel allocated
+ * rings can't be revoked.
+ *
+ * Requests stay in flight across the resize. Completions are held off by
+ * ->completion_lock and submission by ->uring_lock and parking the SQPOLL
+ * thread; the remaining lockless readers (CQ waiters, poll) are under RCU,
+ * so the old kernel mapping is only torn down after a grace period.
+ */
+static int io_register_resize_cq(struct io_ring_ctx *ctx, void __user *arg)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_sq_data *sqd = NULL;
+	struct io_rings *o, *n;
+	struct io_uring_params p;
+	struct page **pages;
+	unsigned int npages, head, tail, i;
+	size_t size, sq_array_offset;
+	int ret;
+
+	if (!(ctx->flags & IORING_SETUP_NO_MMAP))
+		return -EOPNOTSUPP;
+	if (copy_from_user(&p, arg, sizeof(p)))
+		return -EFAULT;
+	if (p.flags || memchr_inv(p.resv, 0, sizeof(p.resv)))
+		return -EINVAL;
+	if (p.sq_entries && p.sq_entries != ctx->sq_entries)
+		return -EINVAL;
+	if (!p.cq_entries || p.cq_entries > IORING_MAX_CQ_ENTRIES)
+		return -EINVAL;
+	p.cq_entries = roundup_pow_of_two(p.cq_entries);
+	if (p.cq_entries < ctx->sq_entries)
+		return -EINVAL;
+
+	size = rings_size(ctx->sq_entries, p.cq_entries, &sq_array_offset);
+	if (size == SIZE_MAX)
+		return -EOVERFLOW;
+	n = io_uaddr_map(&pages, &npages, p.cq_off.user_addr, size);
+	if (IS_ERR(n))
+		return PTR_ERR(n);
+	ret = io_account_mem(ctx, npages);
+	if (ret) {
+		io_pages_unmap(pages, npages);
+		return ret;
+	}
+
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		sqd = ctx->sq_data;
+		if (sqd) {
+			/* see io_register_iowq_max_workers() */
+			refcount_inc(&sqd->refs);
+			mutex_unlock(&ctx->uring_lock);
+			io_sq_thread_park(sqd);
+			mutex_lock(&ctx->uring_lock);
+		}
+	}
+
+	spin_lock(&ctx->completion_lock);
+	o = ctx->rings;
+	head = READ_ONCE(o->cq.head);
+	tail = ctx->cached_cq_tail;
+	if (tail - head > p.cq_entries) {
+		spin_unlock(&ctx->completion_lock);
+		ret = -EOVERFLOW;
+		goto out;
+	}
+
+	memset(n, 0, offsetof(struct io_rings, cqes));
+	n->sq.head = READ_ONCE(o->sq.head);
+	n->sq.tail = READ_ONCE(o->sq.tail);
+	n->sq_ring_mask = ctx->sq_entries - 1;
+	n->sq_ring_entries = ctx->sq_entries;
+	n->sq_flags = READ_ONCE(o->sq_flags);
+	n->sq_dropped = READ_ONCE(o->sq_dropped);
+	n->cq.head = head;
+	n->cq.tail = tail;
+	n->cq_ring_mask = p.cq_entries - 1;
+	n->cq_ring_entries = p.cq_entries;
+	n->cq_flags = READ_ONCE(o->cq_flags);
+	n->cq_overflow = READ_ONCE(o->cq_overflow);
+	for (i = head; i != tail; i++)
+		n->cqes[i & (p.cq_entries - 1)] =
+			o->cqes[i & (ctx->cq_entries - 1)];
+	memcpy((char *)n + sq_array_offset, ctx->sq_array,
+	       array_size(sizeof(u32), ctx->sq_entries));
+
+	smp_store_release(&ctx->rings, n);
+	ctx->sq_array = (u32 *)((char *)n + sq_array_offset);
+	ctx->cq_entries = p.cq_entries;
+	swap(ctx->ring_pages, pages);
+	swap(ctx->n_ring_pages, npages);
+	spin_unlock(&ctx->completion_lock);
+	ret = 0;
+out:
+	if (sqd) {
+		io_sq_thread_unpark(sqd);
+		io_put_sq_data(sqd);
+	}
+	if (!ret) {
+		/* overflowed CQEs may fit now, let waiters retry the flush */
+		wake_up_all(&ctx->cq_wait);
+		synchronize_rcu();
+	}
+	/* the old ring on success, the new one on failure */
+	io_unaccount_mem(ctx, npages);
+	io_pages_unmap(pages, npages);
+	if (ret)
+		return ret;
+
+	io_fill_ring_offsets(ctx, &p);
+	p.sq_entries = ctx->sq_entries;
+	if (copy_to_user(arg, &p, sizeof(p)))
+		return -EFAULT;
+	return 0;
+}
+
 static bool io_register_op_must_quiesce(int op)
 {
 	switch (op) {
@@ -10775,6 +12391,13 @@ static bool io_register_op_must_quiesce(int op)
 	case IORING_REGISTER_IOWQ_AFF:
 	case IORING_UNREGISTER_IOWQ_AFF:
 	case IORING_REGISTER_IOWQ_MAX_WORKERS:
+	case IORING_REGISTER_PBUF_RING:
+	case IORING_UNREGISTER_PBUF_RING:
+	case IORING_REGISTER_SQPOLL_QUOTA:
+	case IORING_REGISTER_RING_FDS:
+	case IORING_UNREGISTER_RING_FDS:
+	case IORING_REGISTER_IOWQ_IDLE_TIMEOUT:
+	case IORING_REGISTER_RESIZE_CQ:
 		return false;
 	default:
 		return true;
@@ -10935,6 +12558,42 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_register_iowq_max_workers(ctx, arg);
 		break;
+	case IORING_REGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_pbuf_ring(ctx, arg);
+		break;
+	case IORING_UNREGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_unregister_pbuf_ring(ctx, arg);
+		break;
+	case IORING_REGISTER_SQPOLL_QUOTA:
+		ret = -EINVAL;
+		if (!arg || nr_args != 2)
+			break;
+		ret = io_register_sqpoll_quota(ctx, arg);
+		break;
+	case IORING_REGISTER_RING_FDS:
+		ret = io_ringfd_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_RING_FDS:
+		ret = io_ringfd_unregister(ctx, arg, nr_args);
+		break;
+	case IORING_REGISTER_IOWQ_IDLE_TIMEOUT:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_iowq_idle_timeout(ctx, arg);
+		break;
+	case IORING_REGISTER_RESIZE_CQ:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_resize_cq(ctx, arg);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -11029,6 +12688,11 @@ static int __init io_uring_init(void)
 	/* ->buf_index is u16 */
 	BUILD_BUG_ON(IORING_MAX_REG_BUFFERS >= (1u << 16));
 
+	/* ->tail must overlay the first buffer's ->resv, see io_uring.h */
+	BUILD_BUG_ON(offsetof(struct io_uring_buf_ring, bufs) != 0);
+	BUILD_BUG_ON(offsetof(struct io_uring_buf, resv) !=
+		     offsetof(struct io_uring_buf_ring, tail));
+
 	/* should fit into one byte */
 	BUILD_BUG_ON(SQE_VALID_FLAGS >= (1 << 8));
 
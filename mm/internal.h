@@ -377,6 +377,7 @@ static inline void mlock_migrate_page(struct page *newpage, struct page *page)
 }
 
 extern pmd_t maybe_pmd_mkwrite(pmd_t pmd, struct vm_area_struct *vma);
+#define mk_huge_pmd(page, prot) pmd_mkhuge(mk_pmd(page, prot))
 
 /*
  * At what user virtual address is page expected in vma?
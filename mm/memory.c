@@ -1001,7 +1001,7 @@ copy_pmd_range(struct vm_area_struct *dst_vma, struct vm_area_struct *src_vma,
 	       unsigned long end)
 {
 	struct mm_struct *dst_mm = dst_vma->vm_mm;
-	// struct mm_struct *src_mm = src_vma->vm_mm;
+	struct mm_struct *src_mm = src_vma->vm_mm;
 	pmd_t *src_pmd, *dst_pmd;
 	unsigned long next;
 
@@ -1011,18 +1011,18 @@ copy_pmd_range(struct vm_area_struct *dst_vma, struct vm_area_struct *src_vma,
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		// if (is_swap_pmd(*src_pmd) || pmd_trans_huge(*src_pmd)
-		// 	|| pmd_devmap(*src_pmd)) {
-		// 	int err;
-		// 	VM_BUG_ON_VMA(next-addr != HPAGE_PMD_SIZE, src_vma);
-		// 	err = copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd,
-		// 			    addr, dst_vma, src_vma);
-		// 	if (err == -ENOMEM)
-		// 		return -ENOMEM;
-		// 	if (!err)
-		// 		continue;
-		// 	/* fall through */
-		// }
+		if (is_swap_pmd(*src_pmd) || pmd_trans_huge(*src_pmd)
+			|| pmd_devmap(*src_pmd)) {
+			int err;
+			VM_BUG_ON_VMA(next-addr != HPAGE_PMD_SIZE, src_vma);
+			err = copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd,
+					    addr, dst_vma, src_vma);
+			if (err == -ENOMEM)
+				return -ENOMEM;
+			if (!err)
+				continue;
+			/* fall through */
+		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_vma, src_vma, dst_pmd, src_pmd,
@@ -1332,14 +1332,13 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		// if (is_swap_pmd(*pmd) || pmd_trans_huge(*pmd) || pmd_devmap(*pmd)) {
-		// 	if (next - addr != HPAGE_PMD_SIZE)
-		// 		__split_huge_pmd(vma, pmd, addr, false, NULL);
-		// 	else if (zap_huge_pmd(tlb, vma, pmd, addr))
-		// 		goto next;
-		// 	/* fall through */
-		// } else if (details && details->single_page &&
-		if (details && details->single_page &&
+		if (is_swap_pmd(*pmd) || pmd_trans_huge(*pmd) || pmd_devmap(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE)
+				__split_huge_pmd(vma, pmd, addr, false, NULL);
+			else if (zap_huge_pmd(tlb, vma, pmd, addr))
+				goto next;
+			/* fall through */
+		} else if (details && details->single_page &&
 			   PageTransCompound(details->single_page) &&
 			   next - addr == HPAGE_PMD_SIZE && pmd_none(*pmd)) {
 			spinlock_t *ptl = pmd_lock(tlb->mm, pmd);
@@ -3743,10 +3742,13 @@ static vm_fault_t pte_alloc_one_map(struct vm_fault *vmf)
 	return 0;
 }
 
+/*
+ * Only anonymous memory is backed by transparent huge pages, so page cache
+ * pages are always mapped with ptes.
+ */
 static vm_fault_t do_set_pmd(struct vm_fault *vmf, struct page *page)
 {
-	BUILD_BUG();
-	return 0;
+	return VM_FAULT_FALLBACK;
 }
 
 /**
@@ -4435,12 +4437,11 @@ static vm_fault_t __handle_mm_fault(struct vm_area_struct *vma,
 	if (pud_trans_unstable(vmf.pud))
 		goto retry_pud;
 
-	// if (pmd_none(*vmf.pmd) && __transparent_hugepage_enabled(vma)) {
-	// 	ret = create_huge_pmd(&vmf);
-	// 	if (!(ret & VM_FAULT_FALLBACK))
-	// 		return ret;
-	// } else {
-	{
+	if (pmd_none(*vmf.pmd) && __transparent_hugepage_enabled(vma)) {
+		ret = create_huge_pmd(&vmf);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else {
 		pmd_t orig_pmd = *vmf.pmd;
 
 		barrier();
@@ -4451,19 +4452,19 @@ static vm_fault_t __handle_mm_fault(struct vm_area_struct *vma,
 				pmd_migration_entry_wait(mm, vmf.pmd);
 			return 0;
 		}
-		// if (pmd_trans_huge(orig_pmd) || pmd_devmap(orig_pmd)) {
-		// 	if (pmd_protnone(orig_pmd) && vma_is_accessible(vma))
-		// 		return do_huge_pmd_numa_page(&vmf, orig_pmd);
-
-		// 	if (dirty && !pmd_write(orig_pmd)) {
-		// 		ret = wp_huge_pmd(&vmf, orig_pmd);
-		// 		if (!(ret & VM_FAULT_FALLBACK))
-		// 			return ret;
-		// 	} else {
-		// 		huge_pmd_set_accessed(&vmf, orig_pmd);
-		// 		return 0;
-		// 	}
-		// }
+		if (pmd_trans_huge(orig_pmd) || pmd_devmap(orig_pmd)) {
+			if (pmd_protnone(orig_pmd) && vma_is_accessible(vma))
+				return do_huge_pmd_numa_page(&vmf, orig_pmd);
+
+			if (dirty && !pmd_write(orig_pmd)) {
+				ret = wp_huge_pmd(&vmf, orig_pmd);
+				if (!(ret & VM_FAULT_FALLBACK))
+					return ret;
+			} else {
+				huge_pmd_set_accessed(&vmf, orig_pmd);
+				return 0;
+			}
+		}
 	}
 
 	return handle_pte_fault(&vmf);
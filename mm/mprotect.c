@@ -244,25 +244,25 @@ static inline unsigned long change_pmd_range(struct vm_area_struct *vma,
 			mmu_notifier_invalidate_range_start(&range);
 		}
 
-		// if (is_swap_pmd(*pmd) || pmd_trans_huge(*pmd) || pmd_devmap(*pmd)) {
-		// 	if (next - addr != HPAGE_PMD_SIZE) {
-		// 		__split_huge_pmd(vma, pmd, addr, false, NULL);
-		// 	} else {
-		// 		int nr_ptes = change_huge_pmd(vma, pmd, addr,
-		// 					      newprot, cp_flags);
-
-		// 		if (nr_ptes) {
-		// 			if (nr_ptes == HPAGE_PMD_NR) {
-		// 				pages += HPAGE_PMD_NR;
-		// 				nr_huge_updates++;
-		// 			}
-
-		// 			/* huge pmd was handled */
-		// 			goto next;
-		// 		}
-		// 	}
-		// 	/* fall through, the trans huge pmd just split */
-		// }
+		if (is_swap_pmd(*pmd) || pmd_trans_huge(*pmd) || pmd_devmap(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE) {
+				__split_huge_pmd(vma, pmd, addr, false, NULL);
+			} else {
+				int nr_ptes = change_huge_pmd(vma, pmd, addr,
+							      newprot, cp_flags);
+
+				if (nr_ptes) {
+					if (nr_ptes == HPAGE_PMD_NR) {
+						pages += HPAGE_PMD_NR;
+						nr_huge_updates++;
+					}
+
+					/* huge pmd was handled */
+					goto next;
+				}
+			}
+			/* fall through, the trans huge pmd just split */
+		}
 		this_pages = change_pte_range(vma, pmd, addr, next, newprot,
 					      cp_flags);
 		pages += this_pages;
@@ -286,24 +286,23 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		new_pmd = alloc_new_pmd(vma->vm_mm, vma, new_addr);
 		if (!new_pmd)
 			break;
-		// if (is_swap_pmd(*old_pmd) || pmd_trans_huge(*old_pmd) || pmd_devmap(*old_pmd)) {
-		// 	if (extent == HPAGE_PMD_SIZE) {
-		// 		bool moved;
-		// 		/* See comment in move_ptes() */
-		// 		if (need_rmap_locks)
-		// 			take_rmap_locks(vma);
-		// 		moved = move_huge_pmd(vma, old_addr, new_addr,
-		// 				      old_pmd, new_pmd);
-		// 		if (need_rmap_locks)
-		// 			drop_rmap_locks(vma);
-		// 		if (moved)
-		// 			continue;
-		// 	}
-		// 	split_huge_pmd(vma, old_pmd, old_addr);
-		// 	if (pmd_trans_unstable(old_pmd))
-		// 		continue;
-		// } else if (extent == PMD_SIZE) {
-		if (extent == PMD_SIZE) {
+		if (is_swap_pmd(*old_pmd) || pmd_trans_huge(*old_pmd) || pmd_devmap(*old_pmd)) {
+			if (extent == HPAGE_PMD_SIZE) {
+				bool moved;
+				/* See comment in move_ptes() */
+				if (need_rmap_locks)
+					take_rmap_locks(vma);
+				moved = move_huge_pmd(vma, old_addr, new_addr,
+						      old_pmd, new_pmd);
+				if (need_rmap_locks)
+					drop_rmap_locks(vma);
+				if (moved)
+					continue;
+			}
+			split_huge_pmd(vma, old_pmd, old_addr);
+			if (pmd_trans_unstable(old_pmd))
+				continue;
+		} else if (extent == PMD_SIZE) {
 #ifdef CONFIG_HAVE_MOVE_PMD
 			/*
 			 * If the extent is PMD-sized, try to speed the move by
@@ -339,6 +339,9 @@ compound_page_dtor * const compound_page_dtors[NR_COMPOUND_DTORS] = {
 #ifdef CONFIG_HUGETLB_PAGE
 	[HUGETLB_PAGE_DTOR] = free_huge_page,
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	[TRANSHUGE_PAGE_DTOR] = free_transhuge_page,
+#endif
 };
 
 int min_free_kbytes = 1024;
@@ -6619,7 +6622,18 @@ static unsigned long __init calc_memmap_size(unsigned long spanned_pages,
 	return PAGE_ALIGN(pages * sizeof(struct page)) >> PAGE_SHIFT;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static void pgdat_init_split_queue(struct pglist_data *pgdat)
+{
+	struct deferred_split *ds_queue = &pgdat->deferred_split_queue;
+
+	spin_lock_init(&ds_queue->split_queue_lock);
+	INIT_LIST_HEAD(&ds_queue->split_queue);
+	ds_queue->split_queue_len = 0;
+}
+#else
 static void pgdat_init_split_queue(struct pglist_data *pgdat) {}
+#endif
 
 #ifdef CONFIG_COMPACTION
 static void pgdat_init_kcompactd(struct pglist_data *pgdat)
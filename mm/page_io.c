@@ -226,6 +226,10 @@ int swap_writepage(struct page *page, struct writeback_control *wbc)
 
 static inline void count_swpout_vm_event(struct page *page)
 {
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (unlikely(PageTransHuge(page)))
+		count_vm_event(THP_SWPOUT);
+#endif
 	count_vm_events(PSWPOUT, thp_nr_pages(page));
 }
 
@@ -798,10 +798,10 @@ static bool page_referenced_one(struct page *page, struct vm_area_struct *vma,
 				if (likely(!(vma->vm_flags & VM_SEQ_READ)))
 					referenced++;
 			}
-		// } else if (IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE)) {
-		// 	if (pmdp_clear_flush_young_notify(vma, address,
-		// 				pvmw.pmd))
-		// 		referenced++;
+		} else if (IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE)) {
+			if (pmdp_clear_flush_young_notify(vma, address,
+						pvmw.pmd))
+				referenced++;
 		} else {
 			/* unexpected pmd-mapped page? */
 			WARN_ON_ONCE(1);
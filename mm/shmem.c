@@ -3829,57 +3829,17 @@ int __init shmem_init(void)
 }
 
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS)
+/*
+ * Only anonymous memory is backed by transparent huge pages; shmem huge
+ * pages stay denied, so the knob is reported but cannot be changed.
+ */
 static ssize_t shmem_enabled_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
-	static const int values[] = {
-		SHMEM_HUGE_ALWAYS,
-		SHMEM_HUGE_WITHIN_SIZE,
-		SHMEM_HUGE_ADVISE,
-		SHMEM_HUGE_NEVER,
-		SHMEM_HUGE_DENY,
-		SHMEM_HUGE_FORCE,
-	};
-	int i, count;
-
-	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
-		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
-
-		count += sprintf(buf + count, fmt,
-				shmem_format_huge(values[i]));
-	}
-	buf[count - 1] = '\n';
-	return count;
-}
-
-static ssize_t shmem_enabled_store(struct kobject *kobj,
-		struct kobj_attribute *attr, const char *buf, size_t count)
-{
-	char tmp[16];
-	int huge;
-
-	if (count + 1 > sizeof(tmp))
-		return -EINVAL;
-	memcpy(tmp, buf, count);
-	tmp[count] = '\0';
-	if (count && tmp[count - 1] == '\n')
-		tmp[count - 1] = '\0';
-
-	huge = shmem_parse_huge(tmp);
-	if (huge == -EINVAL)
-		return -EINVAL;
-	if (!has_transparent_hugepage() &&
-			huge != SHMEM_HUGE_NEVER && huge != SHMEM_HUGE_DENY)
-		return -EINVAL;
-
-	shmem_huge = huge;
-	if (shmem_huge > SHMEM_HUGE_DENY)
-		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
-	return count;
+	return sprintf(buf, "always within_size advise never [deny] force\n");
 }
 
-struct kobj_attribute shmem_enabled_attr =
-	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+struct kobj_attribute shmem_enabled_attr = __ATTR_RO(shmem_enabled);
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE && CONFIG_SYSFS */
 
 #else /* !CONFIG_SHMEM */
@@ -1125,6 +1125,7 @@ struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
 	uarg->len = 1;
 	uarg->bytelen = size;
 	uarg->zerocopy = 1;
+	uarg->flags = 0;
 	refcount_set(&uarg->refcnt, 1);
 	sock_hold(sk);
 
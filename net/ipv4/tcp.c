@@ -1200,12 +1200,23 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 	int flags, err, copied = 0;
 	int mss_now = 0, size_goal, copied_syn = 0;
 	int process_backlog = 0;
-	bool zc = false;
+	bool zc = false, ext_uarg = false;
 	long timeo;
 
 	flags = msg->msg_flags;
 
-	if (flags & MSG_ZEROCOPY && size && sock_flag(sk, SOCK_ZEROCOPY)) {
+	if (flags & MSG_ZEROCOPY && size && msg->msg_ubuf) {
+		/*
+		 * The caller holds a reference across the call and keeps the
+		 * pages pinned until its callback runs, so clones don't need
+		 * to copy them out.
+		 */
+		uarg = msg->msg_ubuf;
+		uarg->flags |= SKBFL_DONT_ORPHAN;
+		ext_uarg = true;
+		zc = sk->sk_route_caps & NETIF_F_SG;
+	} else if (flags & MSG_ZEROCOPY && size &&
+		   sock_flag(sk, SOCK_ZEROCOPY)) {
 		skb = tcp_write_queue_tail(sk);
 		uarg = sock_zerocopy_realloc(sk, size, skb_zcopy(skb));
 		if (!uarg) {
@@ -1422,7 +1433,8 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 		tcp_push(sk, flags, mss_now, tp->nonagle, size_goal);
 	}
 out_nopush:
-	sock_zerocopy_put(uarg);
+	if (!ext_uarg)
+		sock_zerocopy_put(uarg);
 	return copied + copied_syn;
 
 do_error:
@@ -1433,7 +1445,8 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 	if (copied + copied_syn)
 		goto out;
 out_err:
-	sock_zerocopy_put_abort(uarg, true);
+	if (!ext_uarg)
+		sock_zerocopy_put_abort(uarg, true);
 	err = sk_stream_error(sk, flags, err);
 	/* make sure we wake any epoll edge trigger waiter */
 	if (unlikely(tcp_rtx_and_write_queues_empty(sk) && err == -EAGAIN)) {
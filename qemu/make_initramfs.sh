@@ -17,6 +17,8 @@ sudo mknod -m 444 urandom c 1 9
 # sudo chown -v root:tty console ptmx tty
 popd
 
+aarch64-linux-gnu-gcc -O2 -static -o ./initramfs/bin/thp_tlb_bench ../thp_tlb_bench.c
+
 pushd initramfs/
 touch ./init
 chmoe +x ./init
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * TLB-bound microbenchmark for anonymous transparent huge pages.
+ *
+ * Maps a large anonymous array, threads a random cyclic pointer chain
+ * through it with one hop per 4K page and times the dependent loads, so
+ * nearly every access misses the TLB.  Run once with "huge" and once with
+ * "small" to compare MADV_HUGEPAGE against MADV_NOHUGEPAGE:
+ *
+ *	thp_tlb_bench huge 2048
+ *	thp_tlb_bench small 2048
+ *
+ * The second argument is the array size in MiB (default 2048); the guest
+ * needs a little more memory than that.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define SMALL_PAGE	4096UL
+#define HUGE_PAGE	(2UL << 20)
+#define HOPS		(16UL << 20)
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t xorshift64(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void show_stat(const char *path, const char *key)
+{
+	char line[256];
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, key, strlen(key)))
+			printf("  %s", line);
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	int huge = argc > 1 && !strcmp(argv[1], "huge");
+	size_t size = (argc > 2 ? strtoul(argv[2], NULL, 0) : 2048) << 20;
+	size_t pages = size / SMALL_PAGE, i, j, tmp;
+	size_t *perm;
+	char *map, *buf;
+	void **p;
+	double t;
+
+	/* Over-map so the array can start on a PMD boundary. */
+	map = mmap(NULL, size + HUGE_PAGE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	buf = (char *)(((uintptr_t)map + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+	if (madvise(buf, size, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE)) {
+		perror("madvise");
+		return 1;
+	}
+
+	perm = malloc(pages * sizeof(*perm));
+	if (!perm) {
+		perror("malloc");
+		return 1;
+	}
+
+	/* Sattolo's shuffle gives a single cycle through every page. */
+	for (i = 0; i < pages; i++)
+		perm[i] = i;
+	for (i = pages - 1; i > 0; i--) {
+		j = xorshift64() % i;
+		tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+
+	/* Vary the slot inside each page so the chain spreads over the caches. */
+	t = now();
+	for (i = 0; i < pages; i++) {
+		size_t from = perm[i], to = perm[(i + 1) % pages];
+		size_t off = (from * 64) % SMALL_PAGE, to_off = (to * 64) % SMALL_PAGE;
+
+		*(void **)(buf + from * SMALL_PAGE + off) =
+			buf + to * SMALL_PAGE + to_off;
+	}
+	printf("%s: %zu MiB populated in %.2f s\n", huge ? "huge" : "small",
+	       size >> 20, now() - t);
+	free(perm);
+
+	show_stat("/proc/meminfo", "AnonHugePages");
+	show_stat("/proc/vmstat", "thp_fault_alloc");
+
+	/* Every page is on the cycle; page 0 keeps its link at offset 0. */
+	p = (void **)buf;
+	t = now();
+	for (i = 0; i < HOPS; i++)
+		p = *p;
+	t = now() - t;
+
+	printf("  %lu dependent loads: %.2f s, %.1f ns/access (%p)\n",
+	       HOPS, t, t * 1e9 / HOPS, (void *)p);
+	munmap(map, size + HUGE_PAGE);
+	return 0;
+}